@@ -6,9 +6,26 @@ LOCAL_MODULE    := FastCanvasJNI
 LOCAL_SRC_FILES := FastCanvasJNI.cpp \
 				   JNIHelper.cpp \
                    Canvas.cpp \
-				   lodepng.c
-				   
+                   QuadBatch.cpp \
+                   TextureLoader.cpp \
+                   CaptureWriter.cpp \
+				   lodepng.c \
+				   lodepng_unfilter.c
+
+# PNG unfiltering with NEON, only used on armeabi-v7a if the CPU has it
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SRC_FILES += lodepng_unfilter_neon.c.neon
+LOCAL_CFLAGS += -DLODEPNG_UNFILTER_NEON
+endif
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+LOCAL_SRC_FILES += lodepng_unfilter_neon.c
+LOCAL_CFLAGS += -DLODEPNG_UNFILTER_NEON
+endif
+LOCAL_CFLAGS += -DLODEPNG_COMPILE_SIMD_UNFILTER
 
 LOCAL_LDLIBS := -lGLESv1_CM -ldl -llog -landroid
+LOCAL_STATIC_LIBRARIES := cpufeatures
+
+include $(BUILD_SHARED_LIBRARY)
 
-include $(BUILD_SHARED_LIBRARY)
\ No newline at end of file
+$(call import-module,android/cpufeatures)
\ No newline at end of file
@@ -14,6 +14,7 @@
  */
 
 #include "Canvas.h"
+#include <locale.h>
 #include <math.h>
 #include <stdarg.h>
 #include <string.h>
@@ -25,6 +26,8 @@
 #	include "../../../glew/include/GL/glew.h"
 #elif defined(__APPLE__) // These are the iOS headers - not desktop OSX
 #   include <OpenGLES/ES1/gl.h>
+#elif defined(__linux__) // Host builds of the tests, see test/Makefile
+#	include <GLES/gl.h>
 #else
 #	error Platform not defined.
 #endif
@@ -86,9 +89,10 @@ Canvas *Canvas::GetCanvas()
 
 //---------------------------------------------------------------
 
-Canvas::Canvas()
+Canvas::Canvas() : m_captureWriter(this)
 {
     m_contextLost = false;
+    pthread_mutex_init( &m_callbackMutex, NULL );
 #ifdef WIN32
     glewInit();
 #endif
@@ -108,9 +112,33 @@ Canvas::Canvas()
     m_mps = 0.0f;
     m_bytesPS = 0.0f;
     m_msgLen = 0;
+    m_skippedBuilds = 0;
+    m_culledQuads = 0;
+    m_submittedQuads = 0;
+    m_cullingEnabled = false;
+    m_reorderEnabled = false;
+    m_reorderFirst = 0;
 #ifdef USE_INDEX_BUFFER
     m_indexVBO = 0;
 #endif
+    m_transform = Transform::Identity();
+    m_lastFrameValid = false;
+    m_lastFrameBinary = false;
+    m_lastFrameStart = m_lastFrameEnd = m_transform;
+    m_atlasEnabled = false;
+    m_streamIndex = -1;
+    m_recording = NULL;
+    m_recordIndex = -1;
+    m_recordFirstVertex = 0;
+    m_streamStart = 0;
+    for ( int i = 0; i < kNumFrameVBOs; i++) {
+        m_frameVBOs[i] = 0;
+    }
+    m_frameVBOIndex = 0;
+    m_compactTexMatrix = false;
+    m_avoidedGLCalls = 0;
+    m_drawColor.SetWhite();
+    m_frameCacheable = true;
     m_worldColor.SetWhite();
 }
 
@@ -135,6 +163,15 @@ Canvas::~Canvas()
 {
     DLog( "Canvas::~Canvas start." );
     DoContextLost();
+    // A capture being written still adds its callback.
+    m_captureWriter.Stop();
+    for (int i = 0; i < m_capParams.GetSize(); i++) {
+        delete m_capParams[i];
+    }
+    for (int i = 0; i < m_callbacks.GetSize(); i++) {
+        delete m_callbacks[i];
+    }
+    pthread_mutex_destroy( &m_callbackMutex );
     DLog( "Canvas::~Canvas end." );
 }
 
@@ -145,6 +182,8 @@ void Canvas::DoContextLost()
     // It all gets blown away automatically when the context is lost.
 
     m_contextLost = true;
+    m_lastFrameValid = false;
+    m_glState.Invalidate();
 
     int i;
     int size = m_streams.GetSize();
@@ -156,6 +195,26 @@ void Canvas::DoContextLost()
         }
     }
 
+    size = m_displayLists.GetSize();
+    for (i = size-1; i >= 0; i--) {
+        DisplayList *list = m_displayLists[i];
+        m_displayLists.RemoveAt(i);
+        if (list) {
+            delete list;
+        }
+    }
+    m_recording = NULL;
+
+    for (i = 0; i < kNumFrameVBOs; i++) {
+        m_frameVBOs[i] = 0;
+    }
+    m_textStream.vbo = 0;
+    m_compactTexMatrix = false;
+#ifdef USE_INDEX_BUFFER
+    m_indexVBO = 0;
+    m_indices.SetSize(0);
+#endif
+
     size = m_textures.GetSize();
     for (i = size-1; i >= 0; i--) {
         Texture *texture = m_textures[i];
@@ -164,6 +223,18 @@ void Canvas::DoContextLost()
             delete texture;
         }
     }
+    // Shrinking doesn't clear entries, so growing again would bring them back.
+    memset( m_textureTable.GetData(), 0, m_textureTable.GetSize() * sizeof(Texture *) );
+    m_textureTable.SetSize(0);
+
+    size = m_atlasPages.GetSize();
+    for (i = size-1; i >= 0; i--) {
+        AtlasPage *page = m_atlasPages[i];
+        m_atlasPages.RemoveAt(i);
+        if (page) {
+            delete page;
+        }
+    }
 
     DLog( "Canvas::DoContextLost end." );
 }
@@ -193,7 +264,7 @@ void Canvas::DoSetOrtho(int width, int height)
     if (height <= 0) height = 600;
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-#if defined(__ANDROID__) || defined(__APPLE__)
+#if defined(__ANDROID__) || defined(__APPLE__) || defined(__linux__)
     glOrthof(0, width, height, 0, -1, 1);
 #else
     glOrtho(0, width, height, 0, -1, 1);
@@ -201,6 +272,8 @@ void Canvas::DoSetOrtho(int width, int height)
     glMatrixMode(GL_MODELVIEW);
     m_orthoWidth = width;
     m_orthoHeight = height;
+    // What was culled depends on the size.
+    m_lastFrameValid = false;
 }
 
 // There is an assumption here that stride == width * 4. Works on Android, need to confirm on iOS.
@@ -210,67 +283,256 @@ void Canvas::AddTexture(int id, int glID, int width, int height)
     Texture *img = new Texture (id, glID, width, height);
     if (img) {
         DLog( "Canvas::AddTexture id=%d glID=%d width=%d height=%d", id, glID, width, height );
-        m_textures.Append(&img, 1);
+        RegisterTexture( img );
     }
     if ( id == -1 ) {
         m_textStream.texture = img;
     }
+    // Java bound and uploaded the texture.
+    m_glState.Invalidate();
     DLog( "Leaving AddTexture" );
 }
 
 bool Canvas::AddPngTexture(const unsigned char *buffer, long size, int id, unsigned int *pWidth, unsigned int *pHeight)
 {
-    bool success = false;
-    unsigned char *textureDataRGBA = NULL;
-    unsigned int error = lodepng_decode32(&textureDataRGBA, pWidth, pHeight, buffer, (size_t)size);
+    unsigned int error = m_staging.DecodePng(buffer, size);
     if(error) {
         DLog( "Canvas::AddPngTexture Error %d: %s", error, lodepng_error_text(error));
     } else {
+        UploadTexture(m_staging, id, pWidth, pHeight);
+    }
+    m_staging.Trim();
+
+    return error == 0;
+}
+
+void Canvas::QueuePngTexture(FileData *png, int id, const char * callbackID)
+{
+    DLog( "Canvas::QueuePngTexture id=%d size=%ld", id, png->GetSize() );
+    m_textureLoader.Queue( new TextureLoad(id, png, callbackID) );
+}
+
+// Makes a texture of decoded RGBA pixels, the whole padded staging
+// buffer unless it goes in the atlas. *pWidth and *pHeight become the
+// size reported to JS.
+void Canvas::UploadTexture(const StagingBuffer &staging, int id, unsigned int *pWidth, unsigned int *pHeight)
+{
+    *pWidth = staging.GetWidth();
+    *pHeight = staging.GetHeight();
+    if (m_atlasEnabled && AddAtlasTexture(staging.GetPixels(), (int)*pWidth, (int)*pHeight, staging.GetStride(), id)) {
+        // Atlas textures need no padding to a power of 2; report the real size.
+        return;
+    }
+
+    GLuint glID;
+    glGenTextures(1, &glID);
+    m_glState.BindTexture(glID);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    *pWidth = staging.GetPaddedWidth();
+    *pHeight = staging.GetPaddedHeight();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, *pWidth, *pHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, staging.GetPixels());
+
+    AddTexture(id, glID, (int)(*pWidth), (int)(*pHeight));
+}
+
+static double GetMilliseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Uploads textures the loader has finished decoding and queues their
+// callbacks, until kTextureUploadBudgetMs is spent.
+void Canvas::UploadDecodedTextures()
+{
+    double start = 0.0;
+    TextureLoad *load;
+    while ((load = m_textureLoader.TakeDecoded()) != NULL) {
+        if (start == 0.0) {
+            start = GetMilliseconds();
+        }
+
+        if (load->error) {
+            DLog( "Canvas::UploadDecodedTextures id=%d Error %d: %s", load->id, load->error, lodepng_error_text(load->error));
+            AddCallback(load->callbackID, lodepng_error_text(load->error), true);
+        } else {
+            unsigned int width, height;
+            UploadTexture(*load->staging, load->id, &width, &height);
+            char result[32];
+            snprintf(result, sizeof(result), "%u,%u", width, height);
+            AddCallback(load->callbackID, result, false);
+        }
+        m_textureLoader.Recycle(load);
+
+        if (GetMilliseconds() - start >= kTextureUploadBudgetMs) {
+            break;
+        }
+    }
+}
+
+void Canvas::SetTextureAtlas(bool enabled)
+{
+    DLog( "Canvas::SetTextureAtlas %d", enabled );
+    m_atlasEnabled = enabled;
+}
+
+void Canvas::SetViewportCulling(bool enabled)
+{
+    DLog( "Canvas::SetViewportCulling %d", enabled );
+    m_cullingEnabled = enabled;
+    m_lastFrameValid = false;
+}
+
+void Canvas::SetBatchReordering(bool enabled)
+{
+    DLog( "Canvas::SetBatchReordering %d", enabled );
+    m_reorderEnabled = enabled;
+    m_lastFrameValid = false;
+}
+
+AtlasPage* Canvas::FindAtlasPage( int glID, int *pIndex )
+{
+    for ( int i = 0; i < m_atlasPages.GetSize(); i++) {
+        if ( m_atlasPages[i]->GetGlID() == glID ) {
+            if ( pIndex ) *pIndex = i;
+            return m_atlasPages[i];
+        }
+    }
+    return NULL;
+}
+
+// Places a small RGBA image on an atlas page, starting a new page if none
+// has room. Returns false if the image should get a texture of its own.
+// pixels has stride bytes from the start of one row to the next.
+bool Canvas::AddAtlasTexture( const unsigned char *pixels, int width, int height, size_t stride, int id )
+{
+    if ( width > kAtlasMaxTextureSize || height > kAtlasMaxTextureSize ) {
+        return false;
+    }
+    int paddedWidth = width + 2*kAtlasPadding;
+    int paddedHeight = height + 2*kAtlasPadding;
+
+    AtlasPage *page = NULL;
+    int x = 0;
+    int y = 0;
+    for ( int i = 0; i < m_atlasPages.GetSize(); i++) {
+        if ( m_atlasPages[i]->Allocate( paddedWidth, paddedHeight, &x, &y )) {
+            page = m_atlasPages[i];
+            break;
+        }
+    }
+
+    if ( !page ) {
+        GLint maxSize = 0;
+        glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+        int pageSize = kAtlasPageSize;
+        if ( maxSize > 0 && maxSize < pageSize ) {
+            pageSize = maxSize;
+        }
+
         GLuint glID;
         glGenTextures(1, &glID);
-        glBindTexture(GL_TEXTURE_2D, glID);
+        m_glState.BindTexture(glID);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pageSize, pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        DLog( "Canvas::AddAtlasTexture new page glID=%d size=%d", glID, pageSize );
 
-        unsigned int p2Width = 2;
-        while (p2Width < *pWidth) {
-            p2Width *= 2;
+        page = new AtlasPage( glID, pageSize );
+        m_atlasPages.Append( &page, 1 );
+        if ( !page->Allocate( paddedWidth, paddedHeight, &x, &y )) {
+            return false;
         }
+    }
 
-        unsigned int p2Height = 2;
-        while (p2Height < *pHeight) {
-            p2Height *= 2;
+    // Repeat the edge texels into the padding so linear filtering at the
+    // border of the image never picks up its neighbours.
+    unsigned char *padded = (unsigned char *)malloc( paddedWidth * paddedHeight * 4 );
+    if ( !padded ) {
+        return false;
+    }
+    for ( int row = 0; row < paddedHeight; row++ ) {
+        int srcRow = row - kAtlasPadding;
+        if ( srcRow < 0 ) srcRow = 0;
+        if ( srcRow >= height ) srcRow = height - 1;
+        const unsigned char *src = pixels + srcRow * stride;
+        unsigned char *dst = padded + row * paddedWidth * 4;
+        for ( int col = 0; col < kAtlasPadding; col++ ) {
+            memcpy( dst + col * 4, src, 4 );
+            memcpy( dst + (kAtlasPadding + width + col) * 4, src + (width - 1) * 4, 4 );
         }
+        memcpy( dst + kAtlasPadding * 4, src, width * 4 );
+    }
 
-        if (*pWidth == p2Width && *pHeight == p2Height) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, *pWidth, *pHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureDataRGBA);
-        } else {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, p2Width, p2Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, *pWidth, *pHeight, GL_RGBA, GL_UNSIGNED_BYTE, textureDataRGBA);
-            *pWidth = p2Width;
-            *pHeight = p2Height;
-        }
+    m_glState.BindTexture(page->GetGlID());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, paddedWidth, paddedHeight, GL_RGBA, GL_UNSIGNED_BYTE, padded);
+    free( padded );
+
+    Texture *img = new Texture( id, page->GetGlID(), width, height,
+                                x + kAtlasPadding, y + kAtlasPadding, page->GetSize(), page->GetSize() );
+    DLog( "Canvas::AddAtlasTexture id=%d page glID=%d at %d,%d width=%d height=%d", id, page->GetGlID(), x, y, width, height );
+    // Counted first, so replacing a texture on this page doesn't free it.
+    page->refCount++;
+    RegisterTexture( img );
+    return true;
+}
 
-        AddTexture(id, glID, (int)(*pWidth), (int)(*pHeight));
-        success = true;
+void Canvas::RegisterTexture( Texture *img )
+{
+    // A new texture under an ID replaces the old one. Java can reload an
+    // ID after a context loss while its first decode is still in flight.
+    int id = img->GetTextureID();
+    DestroyTexture( id );
+
+    m_textures.Append( &img, 1 );
+    if ( id >= 0 && id < kTextureTableSize ) {
+        if ( id >= m_textureTable.GetSize() ) {
+            m_textureTable.SetSize( id + 1 );
+        }
+        m_textureTable[id] = img;
     }
+    m_lastFrameValid = false;
+}
 
-    if (textureDataRGBA) {
-        free(textureDataRGBA);
+const Texture* Canvas::FindTexture( int id ) const
+{
+    if ( id >= 0 && id < kTextureTableSize ) {
+        return id < m_textureTable.GetSize() ? m_textureTable[id] : NULL;
     }
-
-    return success;
+    int size = m_textures.GetSize();
+    for ( int j = 0; j < size; j++) {
+        if ( m_textures[j]->GetTextureID() == id ) {
+            return m_textures[j];
+        }
+    }
+    return NULL;
 }
 
 void Canvas::RemoveTexture(int id)
 {
     DLog( "Entering Canvas::RemoveTexture" );
+    // A load still in flight would bring the texture back.
+    m_textureLoader.Cancel(id);
+    DestroyTexture(id);
+    DLog( "Leaving Canvas::RemoveTexture" );
+}
+
+// Deletes the texture with the ID, if any, and stops anything drawing it.
+void Canvas::DestroyTexture(int id)
+{
     for( int i=0; i<m_textures.GetSize(); ++i ) {
         Texture *img = m_textures[i];
         if ( img->GetTextureID() == id ) {
             int glID = img->GetGlID();
-            DLog( "Canvas::RemoveTexture id=%d glID=%d width=%d height=%d", id, glID, m_textures[i]->GetWidth(), m_textures[i]->GetHeight() );
+            DLog( "Canvas::DestroyTexture id=%d glID=%d width=%d height=%d", id, glID, m_textures[i]->GetWidth(), m_textures[i]->GetHeight() );
             m_textures.RemoveAt(i);
+            m_lastFrameValid = false;
+            if ( id >= 0 && id < m_textureTable.GetSize() ) {
+                m_textureTable[id] = NULL;
+            }
             // Reset up any streams using this texture
             for ( int j = 0; j < m_streams.GetSize(); j++) {
                 Stream *stream = m_streams[j];
@@ -278,20 +540,40 @@ void Canvas::RemoveTexture(int id)
                     stream->Reset();
                 }
             }
-            // Delete the texture off the card
-            glDeleteTextures(1, (const GLuint *)(&glID));
+            for ( int j = 0; j < m_displayLists.GetSize(); j++) {
+                DisplayList *list = m_displayLists[j];
+                for ( int k = 0; k < list->streams.GetSize(); k++) {
+                    if (list->streams[k]->texture == img) {
+                        list->streams[k]->Reset();
+                    }
+                }
+            }
+            // Delete the texture off the card, unless other textures
+            // still share its atlas page.
+            int pageIndex;
+            AtlasPage *page = FindAtlasPage( glID, &pageIndex );
+            if ( page ) {
+                page->refCount--;
+                if ( page->refCount <= 0 ) {
+                    m_atlasPages.RemoveAt( pageIndex );
+                    delete page;
+                    m_glState.DeleteTexture(glID);
+                }
+            } else {
+                m_glState.DeleteTexture(glID);
+            }
 
             delete img;
             break;
         }
     }
-    DLog( "Leaving Canvas::RemoveTexture" );
 }
 
 void Canvas::EnsureIndex( int nIndex )
 {
 #ifdef USE_INDEX_BUFFER
     ASSERT( nIndex % 6 == 0 );
+    ASSERT( nIndex <= kMaxStreamVertices * 6 / 4 );
     if ( m_indices.GetSize() < nIndex ) {
         m_indices.SetSize( nIndex );
 
@@ -308,38 +590,348 @@ void Canvas::EnsureIndex( int nIndex )
         if ( m_indexVBO == 0 ) {
             glGenBuffers( 1, &m_indexVBO );
         }
-        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_indexVBO );
+        m_glState.BindElementBuffer( m_indexVBO );
         glBufferData( GL_ELEMENT_ARRAY_BUFFER, m_indices.GetSize()*sizeof(uint16_t), m_indices.GetData(), GL_DYNAMIC_DRAW );
-        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
     }
 #endif
 }
 
 
-void Stream::VBOUpload( const DynArray<Vertex2>& vertexBuffer )
+#ifdef USE_COMPACT_VERTICES
+// Checked before any cast to short, which is undefined for NaN and for
+// values out of range. NaN fails every comparison, so it fails this.
+static bool FitsShort( float f )
+{
+    return f >= -32768.0f && f <= 32767.0f;
+}
+
+static bool CanCompact( const Vertex2 *vertices, int count )
+{
+    static const float kScale = (float)CompactVertex2::kTexCoordScale;
+    for ( int i = 0; i < count; i++) {
+        const Vertex2 &v = vertices[i];
+        if (    !FitsShort( v.pos.x ) || v.pos.x != floorf( v.pos.x )
+                || !FitsShort( v.pos.y ) || v.pos.y != floorf( v.pos.y )
+                || !FitsShort( v.tex.x*kScale )
+                || !FitsShort( v.tex.y*kScale ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static short PackTexCoord( float t )
+{
+    float f = t * (float)CompactVertex2::kTexCoordScale;
+    return (short)( f < 0 ? f - 0.5f : f + 0.5f );
+}
+#endif
+
+// Replaces the contents of *vbo, creating it if needed, with the
+// vertices of streams. Each stream's firstVertex indexes vertices; its
+// vboOffset is set to where it ends up in *vbo. glBufferData hands the
+// driver new storage rather than writing into the old, which it can
+// keep until any draws still using it are done.
+void Canvas::UploadStreams( unsigned int *vbo, Stream *const *streams, int count, const Vertex2 *vertices, unsigned int usage )
 {
-    if ( vboVertexID == 0 ) {
-        glGenBuffers( 1, &vboVertexID );
+    if ( *vbo == 0 ) {
+        glGenBuffers( 1, vbo );
     }
 
+    m_uploadBuffer.SetSize(0);
+    for ( int i = 0; i < count; i++) {
+        Stream *stream = streams[i];
+        if ( !stream->texture || stream->nVertex == 0 ) {
+            continue;
+        }
 #ifdef USE_INDEX_BUFFER
-    ASSERT( m_vertexBuffer.GetSize() % 4 == 0 );
+        ASSERT( stream->nVertex % 4 == 0 );
 #else
-    ASSERT( m_vertexBuffer.GetSize() % 6 == 0 );
+        ASSERT( stream->nVertex % 6 == 0 );
 #endif
+        const Vertex2 *src = vertices + stream->firstVertex;
+        int n = stream->nVertex;
+        int offset = m_uploadBuffer.GetSize();
+        stream->vbo = *vbo;
+        stream->vboOffset = offset;
+#ifdef USE_COMPACT_VERTICES
+        stream->compact = CanCompact( src, n );
+#endif
+        if ( !stream->compact && stream->usesColor ) {
+            m_uploadBuffer.Append( (const unsigned char *)src, n*sizeof(Vertex2) );
+            continue;
+        }
+
+        // Streams without color are all white, which is the default
+        // color, so they leave the color out.
+        int stride = stream->GetStride();
+        m_uploadBuffer.SetSize( offset + n*stride );
+        unsigned char *dst = m_uploadBuffer.GetData() + offset;
+        for ( int j = 0; j < n; j++, dst += stride) {
+            if ( stream->compact ) {
+                CompactVertex2 *v = (CompactVertex2 *)dst;
+                v->x = (short)src[j].pos.x;
+                v->y = (short)src[j].pos.y;
+                v->u = PackTexCoord( src[j].tex.x );
+                v->v = PackTexCoord( src[j].tex.y );
+            } else {
+                memcpy( dst, &src[j], 2*sizeof(Vector2) );
+            }
+            if ( stream->usesColor ) {
+                memcpy( dst + stride - sizeof(Color), &src[j].color, sizeof(Color) );
+            }
+        }
+    }
+
+    m_glState.BindArrayBuffer( *vbo );
+    glBufferData( GL_ARRAY_BUFFER, m_uploadBuffer.GetSize(), m_uploadBuffer.GetData(), usage );
+}
+
+
+AtlasPage::AtlasPage( int glID, int size )
+{
+    refCount = 0;
+    m_glID = glID;
+    m_size = size;
+    SkylineNode node = { 0, 0, size };
+    m_skyline.Append( &node, 1 );
+}
+
+// Returns the y at which a w x h rectangle fits with its left edge on
+// skyline node index, or -1 if it doesn't fit there.
+int AtlasPage::FitAt( int index, int w, int h ) const
+{
+    int x = m_skyline[index].x;
+    if ( x + w > m_size ) {
+        return -1;
+    }
+    int y = 0;
+    int remaining = w;
+    for ( int i = index; remaining > 0; i++ ) {
+        ASSERT( i < m_skyline.GetSize() );
+        if ( m_skyline[i].y > y ) {
+            y = m_skyline[i].y;
+        }
+        if ( y + h > m_size ) {
+            return -1;
+        }
+        remaining -= m_skyline[i].width;
+    }
+    return y;
+}
+
+bool AtlasPage::Allocate( int w, int h, int *pX, int *pY )
+{
+    // Bottom-left: lowest top edge wins, ties go to the narrowest node.
+    int best = -1;
+    int bestTop = m_size + 1;
+    int bestWidth = m_size + 1;
+    int bestY = 0;
+    for ( int i = 0; i < m_skyline.GetSize(); i++ ) {
+        int y = FitAt( i, w, h );
+        if ( y < 0 ) {
+            continue;
+        }
+        if ( y + h < bestTop || ( y + h == bestTop && m_skyline[i].width < bestWidth )) {
+            best = i;
+            bestTop = y + h;
+            bestWidth = m_skyline[i].width;
+            bestY = y;
+        }
+    }
+    if ( best < 0 ) {
+        return false;
+    }
+
+    *pX = m_skyline[best].x;
+    *pY = bestY;
+
+    // Insert the new top edge and trim the nodes it now covers.
+    SkylineNode node = { *pX, bestY + h, w };
+    int count = m_skyline.GetSize();
+    m_skyline.SetSize( count + 1 );
+    memmove( &m_skyline[best + 1], &m_skyline[best], (count - best) * sizeof(SkylineNode) );
+    m_skyline[best] = node;
+
+    for ( int i = best + 1; i < m_skyline.GetSize(); ) {
+        SkylineNode &prev = m_skyline[i - 1];
+        SkylineNode &cur = m_skyline[i];
+        int overlap = prev.x + prev.width - cur.x;
+        if ( overlap <= 0 ) {
+            break;
+        }
+        if ( overlap >= cur.width ) {
+            m_skyline.RemoveAt( i );
+            continue;
+        }
+        cur.x += overlap;
+        cur.width -= overlap;
+        break;
+    }
+
+    // Merge neighbours at the same height.
+    for ( int i = 1; i < m_skyline.GetSize(); ) {
+        if ( m_skyline[i - 1].y == m_skyline[i].y ) {
+            m_skyline[i - 1].width += m_skyline[i].width;
+            m_skyline.RemoveAt( i );
+        } else {
+            i++;
+        }
+    }
+    return true;
+}
+
+void GLState::Invalidate()
+{
+    m_arrayBuffer = kUnknown;
+    m_elementBuffer = kUnknown;
+    m_texture = kUnknown;
+    m_texture2D = -1;
+    m_vertexArray = -1;
+    m_texCoordArray = -1;
+    m_colorArray = -1;
+    m_vertexPointer.buffer = kUnknown;
+    m_texCoordPointer.buffer = kUnknown;
+    m_colorPointer.buffer = kUnknown;
+    m_colorKnown = false;
+    m_clearColorKnown = false;
+}
+
+void GLState::BindArrayBuffer( unsigned int id )
+{
+    if ( id == m_arrayBuffer ) {
+        avoided++;
+        return;
+    }
+    glBindBuffer( GL_ARRAY_BUFFER, id );
+    m_arrayBuffer = id;
+}
+
+void GLState::BindElementBuffer( unsigned int id )
+{
+    if ( id == m_elementBuffer ) {
+        avoided++;
+        return;
+    }
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, id );
+    m_elementBuffer = id;
+}
+
+void GLState::BindTexture( unsigned int id )
+{
+    if ( id == m_texture ) {
+        avoided++;
+        return;
+    }
+    glBindTexture( GL_TEXTURE_2D, id );
+    m_texture = id;
+}
+
+// Deleting a bound buffer unbinds it. Pointers set from it may be left
+// dangling, so those are forgotten as well.
+void GLState::DeleteBuffer( unsigned int id )
+{
+    glDeleteBuffers( 1, (const GLuint *)&id );
+    if ( m_arrayBuffer == id ) m_arrayBuffer = 0;
+    if ( m_elementBuffer == id ) m_elementBuffer = 0;
+    if ( m_vertexPointer.buffer == id ) m_vertexPointer.buffer = kUnknown;
+    if ( m_texCoordPointer.buffer == id ) m_texCoordPointer.buffer = kUnknown;
+    if ( m_colorPointer.buffer == id ) m_colorPointer.buffer = kUnknown;
+}
+
+void GLState::DeleteTexture( unsigned int id )
+{
+    glDeleteTextures( 1, (const GLuint *)&id );
+    if ( m_texture == id ) m_texture = 0;
+}
+
+void GLState::EnableTexture2D()
+{
+    if ( m_texture2D == 1 ) {
+        avoided++;
+        return;
+    }
+    glEnable( GL_TEXTURE_2D );
+    m_texture2D = 1;
+}
 
-    if ( nVBOAllocated < vertexBuffer.GetSize() ) {
-        nVBOAllocated = vertexBuffer.GetSize();
-        nVertex = vertexBuffer.GetSize();
-        glBindBuffer( GL_ARRAY_BUFFER, vboVertexID );
-        glBufferData( GL_ARRAY_BUFFER, nVBOAllocated*sizeof(Vertex2), vertexBuffer.GetData(), GL_DYNAMIC_DRAW );
+void GLState::EnableClientState( unsigned int array, bool enable )
+{
+    int *state = array == GL_VERTEX_ARRAY ? &m_vertexArray
+                 : array == GL_TEXTURE_COORD_ARRAY ? &m_texCoordArray
+                 : &m_colorArray;
+    ASSERT( array == GL_VERTEX_ARRAY || array == GL_TEXTURE_COORD_ARRAY || array == GL_COLOR_ARRAY );
+    if ( *state == (int)enable ) {
+        avoided++;
+        return;
+    }
+    if ( enable ) {
+        glEnableClientState( array );
     } else {
-        nVertex = vertexBuffer.GetSize();
-        glBindBuffer( GL_ARRAY_BUFFER, vboVertexID );
-        glBufferSubData ( GL_ARRAY_BUFFER, 0, nVertex*sizeof(Vertex2), vertexBuffer.GetData() );
+        glDisableClientState( array );
+    }
+    *state = enable;
+}
+
+bool GLState::SetPointer( Pointer &p, unsigned int type, int stride, const void *pointer )
+{
+    if (    p.buffer == m_arrayBuffer && m_arrayBuffer != kUnknown
+            && p.type == type && p.stride == stride && p.pointer == pointer ) {
+        avoided++;
+        return false;
+    }
+    p.buffer = m_arrayBuffer;
+    p.type = type;
+    p.stride = stride;
+    p.pointer = pointer;
+    return true;
+}
+
+void GLState::VertexPointer( unsigned int type, int stride, const void *pointer )
+{
+    if ( SetPointer( m_vertexPointer, type, stride, pointer )) {
+        glVertexPointer( 2, type, stride, pointer );
+    }
+}
+
+void GLState::TexCoordPointer( unsigned int type, int stride, const void *pointer )
+{
+    if ( SetPointer( m_texCoordPointer, type, stride, pointer )) {
+        glTexCoordPointer( 2, type, stride, pointer );
+    }
+}
+
+void GLState::ColorPointer( int stride, const void *pointer )
+{
+    if ( SetPointer( m_colorPointer, GL_UNSIGNED_BYTE, stride, pointer )) {
+        glColorPointer( 4, GL_UNSIGNED_BYTE, stride, pointer );
+    }
+}
+
+void GLState::SetColor( const Color &color )
+{
+    if ( m_colorKnown && memcmp( &color, &m_color, sizeof(Color) ) == 0 ) {
+        avoided++;
+        return;
     }
+    glColor4ub( color.r, color.g, color.b, color.a );
+    m_color = color;
+    m_colorKnown = true;
 }
 
+void GLState::ClearColor( float red, float green, float blue )
+{
+    if (    m_clearColorKnown
+            && m_clearColor[0] == red && m_clearColor[1] == green && m_clearColor[2] == blue ) {
+        avoided++;
+        return;
+    }
+    glClearColor( red, green, blue, 1.0f );
+    m_clearColor[0] = red;
+    m_clearColor[1] = green;
+    m_clearColor[2] = blue;
+    m_clearColorKnown = true;
+}
 
 void Canvas::UpdateFrameRate()
 {
@@ -419,7 +1011,10 @@ void Canvas::RenderText( const char* format, ... )
 #endif
         }
         EnsureIndex( len*6 );
-        m_textStream.VBOUpload( m_vertexBuffer );
+        m_textStream.firstVertex = 0;
+        m_textStream.nVertex = m_vertexBuffer.GetSize();
+        Stream *text = &m_textStream;
+        UploadStreams( &m_textStream.vbo, &text, 1, m_vertexBuffer.GetData(), GL_DYNAMIC_DRAW );
         return;
     }
 }
@@ -430,25 +1025,93 @@ void Canvas::Render(const char *renderCommands, int length)
     // Render thread can hit this during destruction
     if (m_contextLost) return;
 
+    UploadDecodedTextures();
+
+    m_worldColor.SetWhite();
+    if (length > 0) {
+        m_messages++;
+        BuildFrame(renderCommands, length, false);
+    }
+    DrawFrame();
+}
+
+void Canvas::RenderBinary(const unsigned char *renderCommands, int length)
+{
+    // Render thread can hit this during destruction
+    if (m_contextLost) return;
+
+    UploadDecodedTextures();
+
     m_worldColor.SetWhite();
     if (length > 0) {
         m_messages++;
-        BuildStreams(renderCommands, length);
+        BuildFrame(renderCommands, length, true);
+    }
+    DrawFrame();
+}
+
+bool Canvas::IsRepeatFrame(const void *renderCommands, int length, bool binary)
+{
+    return m_lastFrameValid
+           && m_lastFrameBinary == binary
+           && m_lastFrame.GetSize() == length
+           && m_transformStack.IsEmpty()
+           && memcmp( &m_transform, &m_lastFrameStart, sizeof(Transform) ) == 0
+           && memcmp( renderCommands, m_lastFrame.GetData(), length ) == 0;
+}
+
+void Canvas::BuildFrame(const void *renderCommands, int length, bool binary)
+{
+    if ( IsRepeatFrame( renderCommands, length, binary )) {
+        // Same commands from the same starting state: the streams and
+        // the frame VBO they point into already hold this frame.
+        m_transform = m_lastFrameEnd;
+        m_msgLen += length;
+        m_skippedBuilds++;
+        return;
+    }
+
+    Transform start = m_transform;
+    bool balanced = m_transformStack.IsEmpty();
+    m_frameCacheable = true;
+
+    if ( binary ) {
+        BuildStreamsBinary( (const unsigned char *)renderCommands, length );
+    } else {
+        BuildStreams( (const char *)renderCommands, length );
+    }
+
+    m_lastFrameValid = balanced && m_transformStack.IsEmpty() && m_frameCacheable;
+    if ( m_lastFrameValid ) {
+        m_lastFrame.SetSize(0);
+        m_lastFrame.Append( (const unsigned char *)renderCommands, length );
+        m_lastFrameBinary = binary;
+        m_lastFrameStart = start;
+        m_lastFrameEnd = m_transform;
     }
+}
+
+void Canvas::DrawFrame()
+{
 #ifdef DEBUG
     UpdateFrameRate();
 #endif
-    glClearColor(m_backgroundRed, m_backgroundGreen, m_backgroundBlue, 1.0f);
-    glClear(  GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
+    m_avoidedGLCalls = m_glState.avoided;
+    m_glState.avoided = 0;
+
+    // Depth and stencil are never used.
+    m_glState.ClearColor(m_backgroundRed, m_backgroundGreen, m_backgroundBlue);
+    glClear( GL_COLOR_BUFFER_BIT );
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    glEnable(GL_TEXTURE_2D);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    // The arrays are left enabled between frames.
+    m_glState.EnableTexture2D();
+    m_glState.EnableClientState(GL_VERTEX_ARRAY, true);
+    m_glState.EnableClientState(GL_TEXTURE_COORD_ARRAY, true);
 
-    glColor4f(1, 1, 1, 1);
+    m_drawColor.SetWhite();
 
     const int size = m_streams.GetSize();
     int quads=0;
@@ -461,78 +1124,185 @@ void Canvas::Render(const char *renderCommands, int length)
         EnsureIndex( nIndex );
     }
 #ifdef DEBUG
-    RenderText( "%d [%d] dc=%d kbps=%d quads=%d", (int)(m_fps+0.5f), (int)(m_mps+0.5f), size, (int)m_bytesPS/1024, quads );
+    RenderText( "%d [%d] dc=%d kbps=%d quads=%d skip=%d cull=%d/%d gl-%d", (int)(m_fps+0.5f), (int)(m_mps+0.5f), size, (int)m_bytesPS/1024, quads, m_skippedBuilds,
+                m_culledQuads, m_culledQuads+m_submittedQuads, m_avoidedGLCalls );
 #endif
     for ( int i = 0; i <= size; ++i) {
         Stream *stream = (i==size) ? &m_textStream : m_streams[i];
-        if ( !stream || !stream->texture ) {
+        if ( !stream ) {
             continue;
         }
-        glBindBuffer(GL_ARRAY_BUFFER, stream->vboVertexID );
-#ifdef USE_INDEX_BUFFER
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexVBO);
-#endif
-        glBindTexture( GL_TEXTURE_2D, stream->texture->GetGlID() );
-
-        glVertexPointer(2, GL_FLOAT, sizeof(Vertex2), (const void*)(0) );               // position
-        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex2), (const void*)(sizeof(Vector2)) ); // texture
-        // This actually makes a difference on some mobile devices. Changes performance from 36 to 51 FPS.
-        if (stream->usesColor) {
-            glEnableClientState(GL_COLOR_ARRAY);
-            glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(Vertex2), (const void*)(sizeof(Vector2)+sizeof(Vector2)) );
-        }
-
-        int nVertex = stream->nVertex;
-#ifdef USE_INDEX_BUFFER
-        int nIndex = nVertex * 6 / 4;
-        ASSERT( nIndex <= m_indices.GetSize() );
-        glDrawElements( GL_TRIANGLES, nIndex, GL_UNSIGNED_SHORT, 0 );
-#else
-        ASSERT( nVertex % 6 == 0 );
-        glDrawArrays( GL_TRIANGLES, 0, nVertex );
-#endif
-        if (stream->usesColor) {
-            glDisableClientState(GL_COLOR_ARRAY);
+        if ( stream->displayList ) {
+            DrawDisplayList( stream );
+        } else {
+            DrawStream( stream );
         }
     }
 
-    //process any capture requests
-    int i = 0;
-    while(!m_capParams.IsEmpty()) {
-        bool isError = true;
-        DLog("CANVAS::Render, about to capture");
-        isError = CaptureGLLayer(m_capParams[i]);
-
-        //create callback if we have one
-        AddCallback(m_capParams[i]->callbackID, m_capParams[i]->fileName, isError);
-        //Callback *cb = new Callback(m_capParams[i]->callbackID, m_capParams[i]->fileName, isError);
-        //m_callbacks.Append(&cb, 1);
-
-        //delete our capture command
-        m_capParams.RemoveAt(i++);
-        DLog("CANVAS::Render, capture success, left in queue: %d",m_capParams.GetSize());
+    // Read back any captures; m_captureWriter writes them out and
+    // adds their callbacks.
+    for ( int i = 0; i < m_capParams.GetSize(); i++ ) {
+        CaptureGLLayer( m_capParams[i] );
     }
+    m_capParams.SetSize( 0 );
 
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDisableClientState(GL_VERTEX_ARRAY);
     CHECK_GLERROR;
 }
 
 
-void Canvas::BuildStreams( const char *renderCommands, int length )
+void Canvas::DrawStream( const Stream *stream )
 {
-    int size = m_streams.GetSize();
-    for ( int i = 0; i < size; i++) {
-        Stream *stream = m_streams[i];
-        if (stream) {
+    if ( !stream->texture ) {
+        return;
+    }
+    m_glState.BindArrayBuffer( stream->vbo );
+#ifdef USE_INDEX_BUFFER
+    m_glState.BindElementBuffer( m_indexVBO );
+#endif
+    m_glState.BindTexture( stream->texture->GetGlID() );
+
+    // Pointing the arrays at the stream's first vertex lets every stream
+    // use the shared indices from 0.
+    const char *base = (const char*)(size_t)stream->vboOffset;
+    int stride = stream->GetStride();
+    if ( stream->compact ) {
+        SetCompactTexMatrix( true );
+        m_glState.VertexPointer( GL_SHORT, stride, base );                      // position
+        m_glState.TexCoordPointer( GL_SHORT, stride, base + 2*sizeof(short) );  // texture
+    } else {
+        SetCompactTexMatrix( false );
+        m_glState.VertexPointer( GL_FLOAT, stride, base );                      // position
+        m_glState.TexCoordPointer( GL_FLOAT, stride, base + sizeof(Vector2) );  // texture
+    }
+    // This actually makes a difference on some mobile devices. Changes performance from 36 to 51 FPS.
+    m_glState.EnableClientState( GL_COLOR_ARRAY, stream->usesColor );
+    if (stream->usesColor) {
+        m_glState.ColorPointer( stride, base + stride - sizeof(Color) );
+    } else {
+        m_glState.SetColor( m_drawColor );
+    }
+
+    int nVertex = stream->nVertex;
+#ifdef USE_INDEX_BUFFER
+    int nIndex = nVertex * 6 / 4;
+    ASSERT( nIndex <= m_indices.GetSize() );
+    glDrawElements( GL_TRIANGLES, nIndex, GL_UNSIGNED_SHORT, 0 );
+#else
+    ASSERT( nVertex % 6 == 0 );
+    glDrawArrays( GL_TRIANGLES, 0, nVertex );
+#endif
+    if (stream->usesColor) {
+        // Drawing with the color array leaves the current color undefined.
+        m_glState.ForgetColor();
+    }
+}
+
+// Compact texture coordinates are fixed point, which the texture matrix
+// scales back to 0..1.
+void Canvas::SetCompactTexMatrix( bool compact )
+{
+    if ( compact == m_compactTexMatrix ) {
+        return;
+    }
+    glMatrixMode( GL_TEXTURE );
+    if ( compact ) {
+        static const float s = 1.0f / (float)CompactVertex2::kTexCoordScale;
+        glScalef( s, s, 1.0f );
+    } else {
+        glLoadIdentity();
+    }
+    glMatrixMode( GL_MODELVIEW );
+    m_compactTexMatrix = compact;
+}
+
+// Replays the streams of a display list under the transform and world
+// color that were current at the call. Streams recorded with a
+// globalAlpha of their own carry per-vertex colors, which take
+// precedence over the world color.
+void Canvas::DrawDisplayList( const Stream *call )
+{
+    const DisplayList *list = call->displayList;
+    const Transform &t = call->transform;
+    const GLfloat matrix[16] = {
+        t.a,  t.b,  0, 0,
+        t.c,  t.d,  0, 0,
+        0,    0,    1, 0,
+        t.tx, t.ty, 0, 1
+    };
+    glLoadMatrixf( matrix );
+    m_drawColor = call->color;
+
+    for ( int i = 0; i < list->streams.GetSize(); ++i ) {
+        DrawStream( list->streams[i] );
+    }
+
+    glLoadIdentity();
+    m_drawColor.SetWhite();
+}
+
+void Canvas::BeginStreams( int length )
+{
+    int size = m_streams.GetSize();
+    for ( int i = 0; i < size; i++) {
+        Stream *stream = m_streams[i];
+        if (stream) {
             stream->Reset();
         }
     }
 
-    Clip clip;
-    int n = -1;
+    m_streamIndex = -1;
     m_vertexBuffer.SetSize(0);
+    m_streamStart = 0;
+    m_culledQuads = 0;
+    m_submittedQuads = 0;
+    m_reorderFirst = 0;
+    m_reorderQuadStreams.SetSize(0);
     m_msgLen += length;
+}
+
+void Canvas::EndStreams()
+{
+    if ( m_recording ) {
+        DLog( "Canvas::EndStreams display list %d was not ended", m_recording->id );
+        DoEndDisplayList();
+    }
+    // Flush the last stream.
+    FlushStream();
+    LayoutReorderedStreams();
+    ExpandQuads();
+
+    if ( m_vertexBuffer.IsEmpty() ) {
+        return;
+    }
+    // One upload for the whole frame, into the buffer least recently used.
+    m_frameVBOIndex = (m_frameVBOIndex + 1) % kNumFrameVBOs;
+    UploadStreams( &m_frameVBOs[m_frameVBOIndex], m_streams.GetData(), m_streamIndex+1,
+                   m_vertexBuffer.GetData(), GL_DYNAMIC_DRAW );
+}
+
+// Closes the stream being built, if any, at the end of m_vertexBuffer.
+// The next draw always starts a new stream. Display list streams count
+// their vertices from the start of the list.
+void Canvas::FlushStream()
+{
+    int size = m_vertexBuffer.GetSize();
+    if ( size == m_streamStart ) {
+        return;
+    }
+    DynArray<Stream *> &streams = m_recording ? m_recording->streams : m_streams;
+    int n = m_recording ? m_recordIndex : m_streamIndex;
+    ASSERT( n >= 0 && n < streams.GetSize() );
+    ASSERT( streams[n]->texture );
+    streams[n]->firstVertex = m_streamStart - (m_recording ? m_recordFirstVertex : 0);
+    streams[n]->nVertex = size - m_streamStart;
+    m_streamStart = size;
+}
+
+void Canvas::BuildStreams( const char *renderCommands, int length )
+{
+    BeginStreams( length );
+
+    Clip clip;
     const char* p = renderCommands;
     const char* end = renderCommands + length;
 
@@ -568,81 +1338,462 @@ void Canvas::BuildStreams( const char *renderCommands, int length )
         } else if ( IsCmd( p, "v" )) {
             // save
             p ++;
-            m_transformStack.Append( &m_transform, 1 );
+            DoSave();
         } else if ( IsCmd( p, "e" )) {
             // restore
             p ++;
-            if ( m_transformStack.GetSize() > 0 ) {
-                m_transform = m_transformStack[m_transformStack.GetSize()-1];
-                m_transformStack.SetSize( m_transformStack.GetSize()-1 );
-            }
+            DoRestore();
         } else if ( IsCmd( p, "a" )) {
             // global alpha
             p++;
-            float alpha = FastFloat( p );
+            float alpha = FastFloat( p, &p );
             while ( *p && *p != ';' ) ++p;
             if ( *p == ';' ) ++p;
-            m_worldColor.a = (int)(255.0*alpha+0.5f);
+            DoGlobalAlpha( alpha );
         } else if ( IsCmd( p, "d" )) {
             p++;
             // Load the clip
             p = ParseDrawImage(p, &clip );
+            DoDrawImage( clip );
+        } else if ( IsCmd( p, "b" )) {
+            // begin display list
+            p++;
+            int id = FastInt( p, &p );
+            p = ParseUnknown(p);
+            DoBeginDisplayList( id );
+        } else if ( IsCmd( p, "n" )) {
+            // end display list
+            p++;
+            p = ParseUnknown(p);
+            DoEndDisplayList();
+        } else if ( IsCmd( p, "c" )) {
+            // call display list
+            p++;
+            int id = FastInt( p, &p );
+            p = ParseUnknown(p);
+            DoCallDisplayList( id );
+        } else if ( IsCmd( p, "x" )) {
+            // delete display list
+            p++;
+            int id = FastInt( p, &p );
+            p = ParseUnknown(p);
+            DoDeleteDisplayList( id );
+        } else {
+            p = ParseUnknown(p);
+        }
+    }
 
-            // Find the texture with ID == clip.textureID
-            const Texture *img = NULL;
-            size = m_textures.GetSize();
-            for ( int j = 0; j < size; j++) {
-                if ( m_textures[j]->GetTextureID() == clip.textureID) {
-                    img = m_textures[j];
-                    break;
-                }
-            }
+    EndStreams();
+    //__android_log_write(ANDROID_LOG_ERROR, "Canvas::BuildStreams", "End");
+}
 
-            // Use the current stream or advance to the next if dealing with a different textureID
-            // Create a new stream if necessary
-            if (img) {
-                // Can we continue with the current stream?
-                if (    n >= 0
-                        && n < m_streams.GetSize()
-                        && m_streams[n]->texture == img ) {
-                } else {
-                    // Switching streams. Flush the current one if needed:
-                    if ( n >= 0 && n < m_streams.GetSize() ) {
-                        m_streams[n]->VBOUpload( m_vertexBuffer );
-                    }
+// Reads packed little-endian operands. Android targets are all little-endian,
+// so this is a straight copy; memcpy keeps unaligned reads legal on ARM.
+static inline const unsigned char* ReadFloats( const unsigned char *p, float *out, int count )
+{
+    memcpy( out, p, count * sizeof(float) );
+    return p + count * sizeof(float);
+}
 
-                    ++n;
-                    if ( n == m_streams.GetSize() ) {
-                        Stream* s = new Stream( img );
-                        m_streams.Append( &s, 1 );
-                    } else {
-                        ASSERT( n < m_streams.GetSize() );
-                        m_streams[n]->texture = img;
-                    }
-#ifdef DEBUG
-                    Stream* stream = m_streams[n];
-                    ASSERT( stream );
-                    ASSERT( stream->texture );
-                    ASSERT( stream->texture->GetTextureID() == clip.textureID );
-#endif
-                    m_vertexBuffer.SetSize(0);
-                }
-                DoPushQuad( m_streams[n], m_transform, clip);
-            }
+void Canvas::BuildStreamsBinary( const unsigned char *renderCommands, int length )
+{
+    BeginStreams( length );
+
+    float tokens[NUM_CLIP_TOKENS];
+    Clip clip;
+    const unsigned char* p = renderCommands;
+    const unsigned char* end = renderCommands + length;
+
+    while ( p < end ) {
+        unsigned char cmd = *p++;
+        int nFloats = 0;
+        int nInts = 0;
+        switch ( cmd ) {
+        case 't':
+        case 'f':
+            nFloats = NUM_XFORM_TOKENS;
+            break;
+        case 'k':
+        case 'l':
+            nFloats = 2;
+            break;
+        case 'r':
+        case 'a':
+            nFloats = 1;
+            break;
+        case 'd':
+            nInts = 1;
+            nFloats = NUM_CLIP_TOKENS;
+            break;
+        case 'b':
+        case 'c':
+        case 'x':
+            nInts = 1;
+            break;
+        case 'm':
+        case 'v':
+        case 'e':
+        case 'n':
+            break;
+        default:
+            // Operand sizes are implied by the opcode, so there is no way to
+            // skip an unknown one. Drop the rest of the frame.
+            DLog( "Canvas::BuildStreamsBinary unknown command 0x%02x at %d", cmd, (int)(p - 1 - renderCommands) );
+            p = end;
+            continue;
+        }
+
+        int nBytes = nInts * sizeof(int) + nFloats * sizeof(float);
+        if ( end - p < nBytes ) {
+            DLog( "Canvas::BuildStreamsBinary truncated command '%c'", cmd );
+            break;
+        }
+
+        int id = 0;
+        if ( nInts ) {
+            memcpy( &id, p, sizeof(int) );
+            p += sizeof(int);
+        }
+
+        if ( cmd == 'd' ) {
+            p = ReadFloats( p, tokens, nFloats );
+            clip.textureID = id;
+            clip.cx = tokens[0];
+            clip.cy = tokens[1];
+            clip.cw = tokens[2];
+            clip.ch = tokens[3];
+            clip.px = tokens[4];
+            clip.py = tokens[5];
+            clip.pw = tokens[6];
+            clip.ph = tokens[7];
+            DoDrawImage( clip );
+            continue;
+        }
+
+        p = ReadFloats( p, tokens, nFloats );
+        switch ( cmd ) {
+        case 't':
+            DoSetTransform( tokens, SET_XFORM, false, m_transform, &m_transform );
+            break;
+        case 'f':
+            DoSetTransform( tokens, SET_XFORM, true, m_transform, &m_transform );
+            break;
+        case 'm':
+            DoSetTransform( tokens, IDENTITY, false, m_transform, &m_transform );
+            break;
+        case 'k':
+            DoSetTransform( tokens, SCALE, true, m_transform, &m_transform );
+            break;
+        case 'r':
+            DoSetTransform( tokens, ROTATE, true, m_transform, &m_transform );
+            break;
+        case 'l':
+            DoSetTransform( tokens, TRANSLATE, true, m_transform, &m_transform );
+            break;
+        case 'v':
+            DoSave();
+            break;
+        case 'e':
+            DoRestore();
+            break;
+        case 'a':
+            DoGlobalAlpha( tokens[0] );
+            break;
+        case 'b':
+            DoBeginDisplayList( id );
+            break;
+        case 'n':
+            DoEndDisplayList();
+            break;
+        case 'c':
+            DoCallDisplayList( id );
+            break;
+        case 'x':
+            DoDeleteDisplayList( id );
+            break;
+        }
+    }
+
+    EndStreams();
+}
+
+void Canvas::DoSave()
+{
+    m_transformStack.Append( &m_transform, 1 );
+}
+
+void Canvas::DoRestore()
+{
+    if ( m_transformStack.GetSize() > 0 ) {
+        m_transform = m_transformStack[m_transformStack.GetSize()-1];
+        m_transformStack.SetSize( m_transformStack.GetSize()-1 );
+    }
+}
+
+void Canvas::DoGlobalAlpha( float alpha )
+{
+    m_worldColor.a = (int)(255.0*alpha+0.5f);
+}
+
+void Canvas::DoDrawImage( const Clip &clip )
+{
+    // Find the texture with ID == clip.textureID
+    const Texture *img = FindTexture( clip.textureID );
+
+    // Culled draws never reach a stream, so they can't leave one empty.
+    if ( img && m_cullingEnabled && !m_recording ) {
+        if ( !IsQuadVisible( m_transform, clip )) {
+            m_culledQuads++;
+            return;
+        }
+        m_submittedQuads++;
+    }
+
+    if ( img && m_reorderEnabled && !m_recording ) {
+        DoDrawImageReordered( img, clip );
+        return;
+    }
+
+    // Use the current stream or advance to the next if dealing with a different textureID
+    // Create a new stream if necessary
+    if (img) {
+        // While recording, draws go to the display list instead of the frame.
+        DynArray<Stream *> &streams = m_recording ? m_recording->streams : m_streams;
+        int &n = m_recording ? m_recordIndex : m_streamIndex;
+        // Can we continue with the current stream? Textures sharing an
+        // atlas page share the stream, as long as it has room for a quad.
+        int streamVertices = m_vertexBuffer.GetSize() - m_streamStart;
+        if (    n >= 0
+                && n < streams.GetSize()
+                && streams[n]->texture
+                && streams[n]->texture->GetGlID() == img->GetGlID()
+                && streamVertices > 0
+                && streamVertices <= kMaxStreamVertices - Quad::kVertexCount ) {
         } else {
-            p = ParseUnknown(p);
+            // Switching streams. Flush the current one if needed:
+            FlushStream();
+            NextStream( streams, n, img );
         }
+        DoPushQuad( streams[n], img, m_transform, clip);
     }
-    // Flush the last stream.
+}
+
+// Advances n to the next stream of streams, creating it if needed, and
+// starts it with img.
+Stream* Canvas::NextStream( DynArray<Stream *> &streams, int &n, const Texture *img )
+{
+    ++n;
+    if ( n == streams.GetSize() ) {
+        Stream* s = new Stream( img );
+        streams.Append( &s, 1 );
+    } else {
+        ASSERT( n < streams.GetSize() );
+        streams[n]->texture = img;
+    }
+    ASSERT( streams[n] );
+    ASSERT( streams[n]->texture );
+    return streams[n];
+}
+
+void Canvas::DoDrawImageReordered( const Texture *img, const Clip &clip )
+{
+    float bounds[4];
+    GetQuadBounds( m_transform, clip, bounds );
+
+    Stream *stream;
+    int n = FindReorderStream( img, bounds );
     if ( n >= 0 ) {
-        ASSERT( n < m_streams.GetSize() );
-        Stream* stream = m_streams[n];
-        ASSERT( stream );
-        ASSERT( stream->texture );
-        ASSERT( stream->texture->GetTextureID() == clip.textureID );
-        stream->VBOUpload( m_vertexBuffer );
+        stream = m_streams[n];
+        if ( bounds[0] < stream->bounds[0] ) stream->bounds[0] = bounds[0];
+        if ( bounds[1] < stream->bounds[1] ) stream->bounds[1] = bounds[1];
+        if ( bounds[2] > stream->bounds[2] ) stream->bounds[2] = bounds[2];
+        if ( bounds[3] > stream->bounds[3] ) stream->bounds[3] = bounds[3];
+    } else {
+        stream = NextStream( m_streams, m_streamIndex, img );
+        n = m_streamIndex;
+        memcpy( stream->bounds, bounds, sizeof(bounds) );
+    }
+
+    if (!m_worldColor.isWhite()) {
+        stream->usesColor = true;
+    }
+    stream->nVertex += Quad::kVertexCount;
+    m_reorderQuadStreams.Append( &n, 1 );
+    m_quadBatch.Add( m_transform, clip, img, m_worldColor, -1 );
+}
+
+// The nearest stream, searching back from the current one, that img can
+// join without changing what is drawn: one with its GL texture and room
+// for a quad, with nothing between it and the end of the frame that
+// overlaps bounds. -1 if there is none.
+int Canvas::FindReorderStream( const Texture *img, const float *bounds ) const
+{
+    int last = m_streamIndex - kReorderLookback + 1;
+    if ( last < m_reorderFirst ) {
+        last = m_reorderFirst;
+    }
+    for ( int i = m_streamIndex; i >= last; i--) {
+        const Stream *s = m_streams[i];
+        if ( s->displayList ) {
+            break;
+        }
+        if (    s->texture->GetGlID() == img->GetGlID()
+                && s->nVertex <= kMaxStreamVertices - Quad::kVertexCount ) {
+            return i;
+        }
+        // Positions are floored, so boxes that only touch share no pixel.
+        if (    bounds[0] < s->bounds[2] && s->bounds[0] < bounds[2]
+                && bounds[1] < s->bounds[3] && s->bounds[1] < bounds[3] ) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Gives the streams built since the last layout consecutive ranges at
+// the end of m_vertexBuffer, and each queued quad its place within its
+// stream in draw order - a counting sort of the quads by stream - then
+// expands them. Laid out streams can't be joined any more.
+void Canvas::LayoutReorderedStreams()
+{
+    int count = m_reorderQuadStreams.GetSize();
+    if ( count > 0 ) {
+        ASSERT( count == m_quadBatch.GetSize() );
+        int first = m_reorderFirst;
+        int nStreams = m_streamIndex + 1 - first;
+        int vertex = m_vertexBuffer.GetSize();
+        m_reorderFill.SetSize( nStreams );
+        for ( int i = 0; i < nStreams; i++) {
+            Stream *stream = m_streams[first+i];
+            stream->firstVertex = vertex;
+            m_reorderFill[i] = vertex;
+            vertex += stream->nVertex;      // 0 for display list calls
+        }
+        m_vertexBuffer.SetSize( vertex );
+        for ( int i = 0; i < count; i++) {
+            int &fill = m_reorderFill[m_reorderQuadStreams[i] - first];
+            m_quadBatch.SetFirstVertex( i, fill );
+            fill += Quad::kVertexCount;
+        }
+        m_reorderQuadStreams.SetSize(0);
+        m_streamStart = vertex;
+        ExpandQuads();
+    }
+    m_reorderFirst = m_streamIndex + 1;
+}
+
+DisplayList* Canvas::FindDisplayList( int id )
+{
+    for ( int i = 0; i < m_displayLists.GetSize(); i++) {
+        if ( m_displayLists[i]->id == id ) {
+            return m_displayLists[i];
+        }
+    }
+    return NULL;
+}
+
+// Draws that follow are recorded into display list id, replacing its
+// previous contents, until the matching end. Vertices are recorded under
+// the transform in effect while recording.
+void Canvas::DoBeginDisplayList( int id )
+{
+    if ( m_recording ) {
+        DLog( "Canvas::DoBeginDisplayList %d while recording %d", id, m_recording->id );
+        DoEndDisplayList();
+    }
+    FlushStream();
+    LayoutReorderedStreams();
+
+    DisplayList *list = FindDisplayList( id );
+    if ( !list ) {
+        list = new DisplayList( id );
+        m_displayLists.Append( &list, 1 );
+    }
+    // Keep the streams and the VBO around for reuse.
+    for ( int i = 0; i < list->streams.GetSize(); i++) {
+        list->streams[i]->Reset();
+    }
+    m_recording = list;
+    m_recordIndex = -1;
+    m_recordFirstVertex = m_vertexBuffer.GetSize();
+}
+
+void Canvas::DoEndDisplayList()
+{
+    if ( !m_recording ) {
+        return;
+    }
+    FlushStream();
+    ExpandQuads();
+
+    // The list keeps its vertices in a VBO of its own, which is only
+    // written again when the list is re-recorded.
+    if ( m_recordIndex >= 0 ) {
+        UploadStreams( &m_recording->vbo, m_recording->streams.GetData(), m_recordIndex+1,
+                       m_vertexBuffer.GetData() + m_recordFirstVertex, GL_STATIC_DRAW );
+    }
+
+    // The shared index buffer has to cover the list streams as well.
+    for ( int i = 0; i <= m_recordIndex; i++) {
+        Stream *stream = m_recording->streams[i];
+        EnsureIndex( stream->nVertex * 6 / 4 );
+    }
+    m_vertexBuffer.SetSize( m_recordFirstVertex );
+    m_streamStart = m_recordFirstVertex;
+    m_recording = NULL;
+    m_recordIndex = -1;
+}
+
+// Adds a stream that replays display list id at this point in the frame.
+void Canvas::DoCallDisplayList( int id )
+{
+    if ( m_recording ) {
+        DLog( "Canvas::DoCallDisplayList %d: display lists can't be nested", id );
+        return;
+    }
+    DisplayList *list = FindDisplayList( id );
+    if ( !list ) {
+        return;
+    }
+    FlushStream();
+
+    int n = ++m_streamIndex;
+    if ( n == m_streams.GetSize() ) {
+        Stream* s = new Stream();
+        m_streams.Append( &s, 1 );
+    }
+    Stream *call = m_streams[n];
+    call->texture = NULL;
+    call->displayList = list;
+    call->transform = m_transform;
+    call->color = m_worldColor;
+}
+
+void Canvas::DoDeleteDisplayList( int id )
+{
+    if ( m_recording && m_recording->id == id ) {
+        DoEndDisplayList();
+    }
+    for ( int i = 0; i < m_displayLists.GetSize(); i++) {
+        DisplayList *list = m_displayLists[i];
+        if ( list->id != id ) {
+            continue;
+        }
+        for ( int j = 0; j < m_streams.GetSize(); j++) {
+            if ( m_streams[j]->displayList == list ) {
+                m_streams[j]->Reset();
+            }
+        }
+        if ( list->vbo ) {
+            m_glState.DeleteBuffer( list->vbo );
+        }
+        m_displayLists.RemoveAt(i);
+        delete list;
+        // Replaying this frame would not delete the list again, but
+        // could draw calls to a list of the same id recorded later.
+        m_frameCacheable = false;
+        break;
     }
-    //__android_log_write(ANDROID_LOG_ERROR, "Canvas::BuildStreams", "End");
 }
 
 // From the current position, past semicolon or to end
@@ -653,18 +1804,28 @@ const char* Canvas::ParseSetTransform( const char *p,
                                        Transform transIn,           // the current xform
                                        Transform *transOut )
 {
-    float tokens[6] = { 0, 0, 0, 0, 0, 0 };
+    float tokens[NUM_XFORM_TOKENS] = { 0, 0, 0, 0, 0, 0 };
     int iToken = 0;
 
-    while ( *p && *p != ';' && iToken < 6 ) {
-        tokens[iToken++] = FastFloat( p );
+    while ( *p && *p != ';' && iToken < NUM_XFORM_TOKENS ) {
+        tokens[iToken++] = FastFloat( p, &p );
+        // Normally already on the separator; skips anything the number grammar doesn't cover.
         while ( *p && (*p != ',' && *p != ';') ) {
             ++p;
         }
         if ( *p == ',' ) ++p;
     }
 
-    Transform t;
+    DoSetTransform( tokens, parseMode, concat, transIn, transOut );
+    if ( *p == ';' ) ++p;
+    return p;
+}
+
+// Builds the transform for parseMode out of the already decoded tokens,
+// and either replaces or concatenates it with transIn.
+void Canvas::DoSetTransform( const float *tokens, int parseMode, bool concat, Transform transIn, Transform *transOut )
+{
+    Transform t = Transform::Identity();
     switch( parseMode ) {
     case IDENTITY:
         break;
@@ -711,25 +1872,25 @@ const char* Canvas::ParseSetTransform( const char *p,
     } else {
         *transOut = t;
     }
-    if ( *p == ';' ) ++p;
-    return p;
+    transOut->Classify();
 }
 
 // From the current position, past semicolon or to end
 // draw the GL texture if we have all the right data
 const char* Canvas::ParseDrawImage( const char* p, Clip *clipOut)
 {
-    float tokens[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    float tokens[NUM_CLIP_TOKENS] = { 0, 0, 0, 0, 0, 0, 0, 0 };
     int iToken = 0;
 
-    while ( *p && *p != ';' && iToken < 9 ) {
+    while ( *p && *p != ';' && iToken < NUM_CLIP_TOKENS+1 ) {
         if ( iToken == 0 ) {
             // First token is the texture ID
-            clipOut->textureID = FastInt( p );
+            clipOut->textureID = FastInt( p, &p );
         } else {
-            tokens[iToken-1] = FastFloat( p );
+            tokens[iToken-1] = FastFloat( p, &p );
         }
         iToken++;
+        // Normally already on the separator; skips anything the number grammar doesn't cover.
         while ( *p && (*p != ',' && *p != ';') ) {
             ++p;
         }
@@ -749,65 +1910,241 @@ const char* Canvas::ParseDrawImage( const char* p, Clip *clipOut)
     return p;
 }
 
-// From the current position, past semicolon or to end
-const char* Canvas::ParseUnknown( const char* p )
+/*static*/
+int Canvas::FastInt( const char *str, const char **end )
 {
-    while( *p && *p != ';' ) {
+    const char *p = str;
+    bool negative = false;
+    if ( *p == '-' || *p == '+' ) {
+        negative = (*p == '-');
         ++p;
     }
-    if ( *p == ';' ) ++p;
-    return p;
+    if ( (unsigned)(*p - '0') > 9 ) {
+        *end = str;
+        return 0;
+    }
+    int value = 0;
+    while ( (unsigned)(*p - '0') <= 9 ) {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    *end = p;
+    return negative ? -value : value;
 }
 
-void Canvas::DoPushQuad (Stream *stream, const Transform &transform, const Clip &clip)
+// strtod of the number text from str to end, with '.' swapped for the
+// locale's decimal point. Correctly rounded, but slow.
+static double StrictParse( const char *str, const char *end )
 {
-    ASSERT( stream );
-    Quad q;
+    const char *point = localeconv()->decimal_point;
+    size_t pointLength = strlen( point );
+    char buffer[128];
+    size_t n = 0;
+    for ( const char *p = str; p < end; ++p ) {
+        if ( n + pointLength + 1 > sizeof(buffer) ) {
+            return NAN;
+        }
+        if ( *p == '.' ) {
+            memcpy( buffer + n, point, pointLength );
+            n += pointLength;
+        } else {
+            buffer[n++] = *p;
+        }
+    }
+    buffer[n] = 0;
+    return strtod( buffer, NULL );
+}
 
-    // Vertex
-    q.vertexArr[0].pos.x = floor(transform.a*clip.px            + transform.c*clip.py           + transform.tx);
-    q.vertexArr[0].pos.y = floor(transform.b*clip.px            + transform.d*clip.py           + transform.ty);
+// Whether value is close enough to halfway between two floats that a
+// small error in it could round it to the wrong one.
+static bool NearFloatHalfway( double value )
+{
+    float f = (float)value;
+    if ( isinf( f ) ) {
+        return false;
+    }
+    double margin = fabs( value ) * (1.0 / (1LL << 48));
+    double below = ((double)f + (double)nextafterf( f, -INFINITY )) * 0.5;
+    double above = ((double)f + (double)nextafterf( f, INFINITY )) * 0.5;
+    return fabs( value - below ) <= margin || fabs( value - above ) <= margin;
+}
 
-    q.vertexArr[1].pos.x = floor(transform.a*(clip.px+clip.pw)  + transform.c*clip.py           + transform.tx);
-    q.vertexArr[1].pos.y = floor(transform.b*(clip.px+clip.pw)  + transform.d*clip.py           + transform.ty);
+/*static*/
+float Canvas::FastFloat( const char *str, const char **end )
+{
+    // Exact powers of ten representable in a double.
+    static const double kPow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const int kMaxPow10 = sizeof(kPow10) / sizeof(kPow10[0]) - 1;
+    static const int kMaxDigits = 19;   // fits in 64 bits
+
+    const char *p = str;
+    bool negative = false;
+    if ( *p == '-' || *p == '+' ) {
+        negative = (*p == '-');
+        ++p;
+    }
 
-    q.vertexArr[2].pos.x = floor(transform.a*(clip.px+clip.pw)  + transform.c*(clip.py+clip.ph) + transform.tx);
-    q.vertexArr[2].pos.y = floor(transform.b*(clip.px+clip.pw)  + transform.d*(clip.py+clip.ph) + transform.ty);
+    unsigned long long mantissa = 0;
+    int nDigits = 0;
+    int exponent = 0;
+    bool any = false;
+    bool dropped = false;   // nonzero digits past kMaxDigits
 
-    q.vertexArr[3].pos.x = floor(transform.a*clip.px            + transform.c*(clip.py+clip.ph) + transform.tx);
-    q.vertexArr[3].pos.y = floor(transform.b*clip.px            + transform.d*(clip.py+clip.ph) + transform.ty);
+    while ( (unsigned)(*p - '0') <= 9 ) {
+        if ( nDigits < kMaxDigits ) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if ( mantissa ) ++nDigits;
+        } else {
+            dropped |= (*p != '0');
+            ++exponent;
+        }
+        any = true;
+        ++p;
+    }
+    if ( *p == '.' ) {
+        ++p;
+        while ( (unsigned)(*p - '0') <= 9 ) {
+            if ( nDigits < kMaxDigits ) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if ( mantissa ) ++nDigits;
+                --exponent;
+            } else {
+                dropped |= (*p != '0');
+            }
+            any = true;
+            ++p;
+        }
+    }
+    if ( !any ) {
+        *end = str;
+        return 0.0f;
+    }
 
-    // Texture
-    float width  = (float)stream->texture->GetWidth();
-    float height = (float)stream->texture->GetHeight();
+    // Number.toString() switches to exponent form outside 1e-7 .. 1e21.
+    if ( *p == 'e' || *p == 'E' ) {
+        const char *e = p + 1;
+        int expValue = FastInt( e, &e );
+        if ( e != p + 1 ) {
+            exponent += expValue;
+            p = e;
+        }
+    }
+    *end = p;
+
+    double value = (double)mantissa;
+    if ( mantissa != 0 && exponent != 0 ) {
+        if ( exponent < 0 && exponent >= -kMaxPow10 ) {
+            value /= kPow10[-exponent];
+        } else if ( exponent > 0 && exponent <= kMaxPow10 ) {
+            value *= kPow10[exponent];
+        } else {
+            value *= pow( 10.0, (double)exponent );
+        }
+    }
 
-    q.vertexArr[0].tex.x = clip.cx           / width;
-    q.vertexArr[0].tex.y = clip.cy           / height;
+    // The above is exact only for mantissas up to 2^53 and table powers.
+    // Otherwise it can be a double rounding off, which matters only when
+    // that tips the float, next to a halfway point. Number.toString()'s 17
+    // digit numbers get here, but rarely need the slow parse.
+    bool exact = !dropped && mantissa <= (1ULL << 53) &&
+                 exponent >= -kMaxPow10 && exponent <= kMaxPow10;
+    if ( !exact && mantissa != 0 && NearFloatHalfway( value ) ) {
+        double strict = StrictParse( str, p );
+        if ( !isnan( strict ) ) {
+            return (float)strict;
+        }
+    }
+    return (float)(negative ? -value : value);
+}
 
-    q.vertexArr[1].tex.x = (clip.cx+clip.cw) / width;
-    q.vertexArr[1].tex.y = clip.cy           / height;
+// From the current position, past semicolon or to end
+const char* Canvas::ParseUnknown( const char* p )
+{
+    while( *p && *p != ';' ) {
+        ++p;
+    }
+    if ( *p == ';' ) ++p;
+    return p;
+}
 
-    q.vertexArr[2].tex.x = (clip.cx+clip.cw) / width;
-    q.vertexArr[2].tex.y = (clip.cy+clip.ch) / height;
+// The box minX, minY, maxX, maxY around the quad of clip under
+// transform, before its corners are floored.
+void Canvas::GetQuadBounds( const Transform &transform, const Clip &clip, float *bounds ) const
+{
+    float x0 = clip.px;
+    float y0 = clip.py;
+    float x1 = clip.px+clip.pw;
+    float y1 = clip.py+clip.ph;
+
+    if ( transform.kind == Transform::kGeneral ) {
+        float x[4], y[4];
+        x[0] = transform.a*x0 + transform.c*y0 + transform.tx;
+        y[0] = transform.b*x0 + transform.d*y0 + transform.ty;
+        x[1] = transform.a*x1 + transform.c*y0 + transform.tx;
+        y[1] = transform.b*x1 + transform.d*y0 + transform.ty;
+        x[2] = transform.a*x1 + transform.c*y1 + transform.tx;
+        y[2] = transform.b*x1 + transform.d*y1 + transform.ty;
+        x[3] = transform.a*x0 + transform.c*y1 + transform.tx;
+        y[3] = transform.b*x0 + transform.d*y1 + transform.ty;
+        bounds[0] = bounds[2] = x[0];
+        bounds[1] = bounds[3] = y[0];
+        for ( int i = 1; i < 4; i++) {
+            if ( x[i] < bounds[0] ) bounds[0] = x[i];
+            if ( x[i] > bounds[2] ) bounds[2] = x[i];
+            if ( y[i] < bounds[1] ) bounds[1] = y[i];
+            if ( y[i] > bounds[3] ) bounds[3] = y[i];
+        }
+    } else {
+        // Axis aligned, but a negative scale or size swaps the edges.
+        x0 = transform.a*x0 + transform.tx;
+        x1 = transform.a*x1 + transform.tx;
+        y0 = transform.d*y0 + transform.ty;
+        y1 = transform.d*y1 + transform.ty;
+        bounds[0] = x0 < x1 ? x0 : x1;
+        bounds[2] = x0 < x1 ? x1 : x0;
+        bounds[1] = y0 < y1 ? y0 : y1;
+        bounds[3] = y0 < y1 ? y1 : y0;
+    }
+}
 
-    q.vertexArr[3].tex.x = clip.cx           / width;
-    q.vertexArr[3].tex.y = (clip.cy+clip.ch) / height;
+// Whether the quad of clip under transform can touch the ortho
+// rectangle. Positions are floored once transformed, so a quad whose
+// right or bottom edge is at or before 0 covers no pixel on screen.
+bool Canvas::IsQuadVisible( const Transform &transform, const Clip &clip ) const
+{
+    float bounds[4];
+    GetQuadBounds( transform, clip, bounds );
+    return bounds[2] > 0 && bounds[3] > 0
+           && bounds[0] < (float)m_orthoWidth && bounds[1] < (float)m_orthoHeight;
+}
 
-    q.vertexArr[0].color = m_worldColor;
-    q.vertexArr[1].color = m_worldColor;
-    q.vertexArr[2].color = m_worldColor;
-    q.vertexArr[3].color = m_worldColor;
+// Reserves the quad's vertices at the end of the stream and queues it
+// for ExpandQuads, which writes them.
+void Canvas::DoPushQuad (Stream *stream, const Texture *texture, const Transform &transform, const Clip &clip)
+{
+    ASSERT( stream );
+    ASSERT( texture && texture->GetGlID() == stream->texture->GetGlID() );
 
     if (!m_worldColor.isWhite()) {
         stream->usesColor = true;
     }
 
-    // Write
-    m_vertexBuffer.Append( q.vertexArr, Quad::kQuadArrSize );
-#ifndef USE_INDEX_BUFFER
-    m_vertexBuffer.Append( &q.vertexArr[0], 1 );
-    m_vertexBuffer.Append( &q.vertexArr[2], 1 );
-#endif
+    int first = m_vertexBuffer.GetSize();
+    m_vertexBuffer.SetSize( first + Quad::kVertexCount );
+    m_quadBatch.Add( transform, clip, texture, m_worldColor, first );
+    if ( m_quadBatch.GetSize() >= kMaxQuadBatch ) {
+        ExpandQuads();
+    }
+}
+
+void Canvas::ExpandQuads()
+{
+    if ( !m_quadBatch.IsEmpty() ) {
+        m_quadBatch.Expand( m_vertexBuffer.GetData() );
+    }
 }
 
 
@@ -816,7 +2153,7 @@ void Canvas::OnSurfaceChanged( int width, int height )
 {
     glClearColor(m_backgroundRed, m_backgroundGreen, m_backgroundBlue, 1.0f);
     glShadeModel(GL_SMOOTH);
-#if defined(__ANDROID__) || defined(__APPLE__)
+#if defined(__ANDROID__) || defined(__APPLE__) || defined(__linux__)
     glClearDepthf(1.0f);
 #else
     glClearDepth(1.0f);
@@ -839,19 +2176,24 @@ void Canvas::OnSurfaceChanged( int width, int height )
     glLoadIdentity();
     glClear( GL_COLOR_BUFFER_BIT );
 
+    // The context may be new, or Java may have changed the state.
+    m_glState.Invalidate();
     m_contextLost = false;
 }
 
 //called from JNI or Obj-C to indicate we want to readback the GL layer into a file on the next render
-void Canvas::QueueCaptureGLLayer(int x, int y, int w, int h, const char * callbackID, const char * fn)
+void Canvas::QueueCaptureGLLayer(int x, int y, int w, int h, const char * callbackID, const char * fn, int compression,
+                                 int output, int thumbWidth, int thumbHeight)
 {
-    CaptureParams *params = new CaptureParams(x,y,w,h,callbackID,fn);
+    CaptureParams *params = new CaptureParams(x,y,w,h,callbackID,fn,compression,output,thumbWidth,thumbHeight);
     m_capParams.Append(&params, 1);
     DLog("Canvas.cpp::QueueCaptureGLLayer - queued");
 }
 
-//called from within render when QueueCaptureGLLayer has been called
-bool Canvas::CaptureGLLayer(CaptureParams * params)
+//called from within render when QueueCaptureGLLayer has been called.
+//Takes ownership of params. Only reads the pixels; the flip, encode and
+//file write happen on m_captureWriter's thread.
+void Canvas::CaptureGLLayer(CaptureParams * params)
 {
     //get the dimensions of the current viewport
     int results[4];
@@ -873,81 +2215,41 @@ bool Canvas::CaptureGLLayer(CaptureParams * params)
     //flip y axis to be in openGL lower left origin
     y = results[3] - y - height;
 
-    //use glGetPixels to get the bits from the current frame buffer
-    // Make the BYTE array, factor of 3 because it's RBG.
-    GLubyte *pixels = new GLubyte [4 * width * height];
-    if (!pixels) {
+    CaptureJob *job = m_captureWriter.NewJob(params, width, height);
+    if (!job) {
         DLog( "Canvas::CaptureGLLayer Unable to allocate buffer");
-        return true;
-    }
-    glFinish();
-    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-
-    // taken from example here: http://www.codesampler.com/2010/11/02/introduction-to-opengl-es-2-0/
-    // Flip and invert the PNG image since OpenGL likes to load everything
-    // backwards from what is considered normal!
-    int halfTheHeightInPixels = height / 2;
-    int heightInPixels = height;
-
-    // Assuming RGBA for 4 components per pixel.
-    int numColorComponents = 4;
-
-    // Assuming each color component is an unsigned char.
-    int widthInChars = width * numColorComponents;
-
-    unsigned char *top = NULL;
-    unsigned char *bottom = NULL;
-    unsigned char temp = 0;
-
-    for( int h = 0; h < halfTheHeightInPixels; ++h ) {
-        top = pixels + h * widthInChars;
-        bottom = pixels + (heightInPixels - h - 1) * widthInChars;
-
-        for( int w = 0; w < widthInChars; ++w ) {
-            // Swap the chars around.
-            temp = *top;
-            *top = *bottom;
-            *bottom = temp;
-
-            ++top;
-            ++bottom;
-        }
+        AddCallback(params->callbackID, "Unable to allocate buffer", true);
+        delete params;
+        return;
     }
 
-    //use loadpng library to write the rawbits to png
-    //Encode the image
-    unsigned error = lodepng_encode32_file(params->fileName, pixels, width, height);
-
-    // Free memory
-    delete pixels;
-
-    //if there's an error, display it
-    if(error) {
-        DLog( "Canvas::CaptureGLLayer Error %d: %s", error, lodepng_error_text(error));
-        strncpy( params->fileName, lodepng_error_text(error), CaptureParams::ALLOCATED-1 );
-        params->fileName[CaptureParams::ALLOCATED-1] = 0;
-        //strcpy(params->fileName, lodepng_error_text(error));
-        return true;
-    } else {
-        DLog( "Canvas::CaptureGLLayer png written: %s",params->fileName);
-        return false;
-    }
+    // glReadPixels waits for the frame to finish drawing by itself.
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, job->pixels);
+    m_captureWriter.Queue(job);
 }
 
 //Get the front of the callback queue
 Callback * Canvas::GetNextCallback()
 {
+    Callback *cb = NULL;
+    pthread_mutex_lock( &m_callbackMutex );
     if(!m_callbacks.IsEmpty())
-        return m_callbacks[0];
-    else
-        return NULL;
+        cb = m_callbacks[0];
+    pthread_mutex_unlock( &m_callbackMutex );
+    return cb;
 }
 
 //delete the front of the callback queue
 void Canvas::PopCallbacks()
 {
-    if(!m_callbacks.IsEmpty())
+    Callback *cb = NULL;
+    pthread_mutex_lock( &m_callbackMutex );
+    if(!m_callbacks.IsEmpty()) {
+        cb = m_callbacks[0];
         m_callbacks.RemoveAt(0);
+    }
+    pthread_mutex_unlock( &m_callbackMutex );
+    delete cb;
 }
 
 //push to the end of the callback queue
@@ -955,11 +2257,27 @@ void Canvas::AddCallback(const char * callbackID, const char * result, bool isEr
 {
     if(callbackID != NULL && *callbackID != '\0') {
         Callback *cb = new Callback(callbackID, result, isError);
+        pthread_mutex_lock( &m_callbackMutex );
         m_callbacks.Append(&cb, 1);
+        pthread_mutex_unlock( &m_callbackMutex );
         DLog("Canvas::AddCallback - Callback created: %s, %s, %d",callbackID, result, isError);
     }
 }
 
+//push a callback answering with data, which it takes ownership of
+void Canvas::AddCallback(const char * callbackID, unsigned char * data, size_t size)
+{
+    if(callbackID != NULL && *callbackID != '\0') {
+        Callback *cb = new Callback(callbackID, data, size);
+        pthread_mutex_lock( &m_callbackMutex );
+        m_callbacks.Append(&cb, 1);
+        pthread_mutex_unlock( &m_callbackMutex );
+        DLog("Canvas::AddCallback - Callback created: %s, %d bytes",callbackID, (int)size);
+    } else {
+        free(data);
+    }
+}
+
 CaptureParams::CaptureParams()
 {
     DLog("CaptureParams::CaptureParams()");
@@ -969,19 +2287,27 @@ CaptureParams::CaptureParams()
     y = results[1];
     width = results[2];
     height = results[3];
+    compression = COMPRESS_DEFAULT;
+    output = OUTPUT_FILE;
+    thumbWidth = 0;
+    thumbHeight = 0;
     const char * defName = "screenshot.png";
     strncpy( fileName, defName, ALLOCATED-1);
     fileName[ALLOCATED-1] = 0;
 }
 
-CaptureParams::CaptureParams(int xPos, int yPos, int w, int h, const char * callback, const char * fn)
+CaptureParams::CaptureParams(int xPos, int yPos, int w, int h, const char * callback, const char * fn, int level,
+                             int out, int thumbW, int thumbH)
 {
     DLog("CaptureParams::CaptureParams(int,int,int,int const char*, const char *)");
     x = xPos;
     y = yPos;
     width = w;
     height = h;
-
+    compression = level;
+    output = out;
+    thumbWidth = thumbW;
+    thumbHeight = thumbH;
 
     strncpy( callbackID, callback, ALLOCATED-1 );
     callbackID[ALLOCATED-1]=0;
@@ -999,4 +2325,22 @@ Callback::Callback(const char * id, const char * res, bool error)
     strncpy( result, res, ALLOCATED-1 );
     result[ALLOCATED-1] = 0;
     isError = error;
+    data = NULL;
+    dataSize = 0;
+}
+
+Callback::Callback(const char * id, unsigned char * bytes, size_t size)
+{
+    strncpy( callbackID, id, ALLOCATED-1 );
+    callbackID[ALLOCATED-1] = 0;
+
+    result[0] = 0;
+    isError = false;
+    data = bytes;
+    dataSize = size;
+}
+
+Callback::~Callback()
+{
+    free( data );
 }
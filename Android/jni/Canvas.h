@@ -18,11 +18,13 @@
 #define _Included_Canvas
 
 #define USE_INDEX_BUFFER
+#define USE_COMPACT_VERTICES
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
 
 // Formatted using Artistic Style
 // AStyle.exe --style=kr Canvas.h Canvas.cpp
@@ -150,7 +152,6 @@ DynArray<T>::SetSize(int size)
     }
 
     m_size = size;
-    ASSERT( m_size < 10*1000);    // sanity check.
 }
 
 // -----------------------------------------------------------
@@ -169,8 +170,36 @@ struct Clip {
 // --    Populates the vertexArr of a Quad
 // -----------------------------------------------------------
 struct Transform {
-    Transform() : a(1), b(0), c(0), d(1), tx(0), ty(0) {}
+    // What the matrix does, so DoPushQuad can skip the arithmetic
+    // that would have no effect.
+    enum Kind {
+        kIdentity,
+        kTranslate,         // a == d == 1, b == c == 0
+        kScale,             // b == c == 0
+        kGeneral
+    };
+
+    // No constructor, so DynArray can realloc and memset these.
+    static Transform Identity() {
+        Transform t = { 1, 0, 0, 1, 0, 0, kIdentity };
+        return t;
+    }
+
+    // Sets kind from the matrix. Call after changing any of it.
+    void Classify() {
+        if ( b != 0 || c != 0 ) {
+            kind = kGeneral;
+        } else if ( a != 1 || d != 1 ) {
+            kind = kScale;
+        } else if ( tx != 0 || ty != 0 ) {
+            kind = kTranslate;
+        } else {
+            kind = kIdentity;
+        }
+    }
+
     float a, b, c, d, tx, ty;
+    int kind;
 };
 
 // -----------------------------------------------------------
@@ -185,6 +214,25 @@ public:
         m_glID = glID;
         m_Width = w;
         m_Height = h;
+        m_x = 0;
+        m_y = 0;
+        m_glWidth = w;
+        m_glHeight = h;
+        SetInvGlSize();
+    }
+
+    // A texture occupying the w x h rectangle at x, y of a larger GL
+    // texture, such as an atlas page.
+    Texture (int textureID, int glID, int w, int h, int x, int y, int glWidth, int glHeight) {
+        m_textureID = textureID;
+        m_glID = glID;
+        m_Width = w;
+        m_Height = h;
+        m_x = x;
+        m_y = y;
+        m_glWidth = glWidth;
+        m_glHeight = glHeight;
+        SetInvGlSize();
     }
 
     int GetTextureID () const {
@@ -199,12 +247,79 @@ public:
     int GetHeight () const {
         return m_Height;
     }
+    int GetX () const {
+        return m_x;
+    }
+    int GetY () const {
+        return m_y;
+    }
+    int GetGlWidth () const {
+        return m_glWidth;
+    }
+    int GetGlHeight () const {
+        return m_glHeight;
+    }
+    // 1/GetGlWidth() and 1/GetGlHeight(), for texture coordinates.
+    float GetInvGlWidth () const {
+        return m_invGlWidth;
+    }
+    float GetInvGlHeight () const {
+        return m_invGlHeight;
+    }
 
 private:
+    void SetInvGlSize() {
+        m_invGlWidth = m_glWidth > 0 ? 1.0f / (float)m_glWidth : 0.0f;
+        m_invGlHeight = m_glHeight > 0 ? 1.0f / (float)m_glHeight : 0.0f;
+    }
+
     int m_textureID;
     int m_glID;
     int m_Width;
     int m_Height;
+    int m_x;
+    int m_y;
+    int m_glWidth;
+    int m_glHeight;
+    float m_invGlWidth;
+    float m_invGlHeight;
+};
+
+// -----------------------------------------------------------
+// --    AtlasPage utility class
+//
+//  A GL texture shared by many small textures so that draws
+//  using any of them batch into one stream. Rectangles are
+//  allocated with a bottom-left skyline packer; space is only
+//  reclaimed when every texture on the page has been removed.
+// -----------------------------------------------------------
+class AtlasPage
+{
+public:
+    AtlasPage( int glID, int size );
+
+    // Finds room for a w x h rectangle. Returns false if the page is full.
+    bool Allocate( int w, int h, int *pX, int *pY );
+
+    int GetGlID () const {
+        return m_glID;
+    }
+    int GetSize () const {
+        return m_size;
+    }
+
+    int refCount;   // Textures currently placed on this page.
+
+private:
+    struct SkylineNode {
+        int x, y, width;
+    };
+
+    int FitAt( int index, int w, int h ) const;
+
+    int m_glID;
+    int m_size;
+    DynArray<SkylineNode> m_skyline;
 };
 
 
@@ -237,28 +352,166 @@ struct Vertex2 {
     Color   color;
 };
 
+// Vertex2 as uploaded for streams whose positions are whole numbers
+// that fit in 16 bits, which is nearly all of them since quads are
+// snapped to integers. Texture coordinates are fixed point, in units of
+// 1/kTexCoordScale, which is exact for texel edges of power of 2
+// textures up to that size.
+struct CompactVertex2 {
+    enum { kTexCoordScale = 16384 };
+    short   x, y;
+    short   u, v;
+    Color   color;
+};
+
 // -----------------------------------------------------------
 // --    Quad utility class
 // --    Passed to Stream::pushQuad
 // -----------------------------------------------------------
 struct Quad {
     enum { kQuadArrSize = 4 };
+#ifdef USE_INDEX_BUFFER
+    enum { kVertexCount = 4 };      // Vertices a quad takes up in a stream.
+#else
+    enum { kVertexCount = 6 };
+#endif
     Vertex2 vertexArr[kQuadArrSize];
 };
 
+// -----------------------------------------------------------
+// --    QuadBatch utility class
+//
+//  Draws that have been parsed but not yet expanded into
+//  vertices, kept as a structure of arrays. DoPushQuad reserves
+//  each quad's vertices and queues it here; Expand then writes
+//  the whole batch, four quads at a time with NEON or SSE2 when
+//  the compiler targets them. See QuadBatch.cpp.
+// -----------------------------------------------------------
+class QuadBatch
+{
+public:
+    QuadBatch() {}
+
+    // Queues a quad whose vertices start at firstVertex, which may be
+    // set later with SetFirstVertex.
+    void Add( const Transform &transform, const Clip &clip, const Texture *texture,
+              const Color &color, int firstVertex );
+
+    // Writes every queued quad into vertices and empties the batch.
+    void Expand( Vertex2 *vertices );
+
+    // For quads queued before their place was known.
+    void SetFirstVertex( int i, int firstVertex ) {
+        m_firstVertex[i] = firstVertex;
+    }
+
+    int GetSize() const {
+        return m_firstVertex.GetSize();
+    }
+    bool IsEmpty() const {
+        return m_firstVertex.IsEmpty();
+    }
+
+private:
+    QuadBatch(const QuadBatch & that);                // private, undefined
+    QuadBatch &operator = (const QuadBatch &that);    // private, undefined
+
+    void ExpandScalar( int i, Vertex2 *vertices ) const;
+    void WriteQuad( int i, const float *x, const float *y, Vertex2 *vertices ) const;
+
+    // Per quad: destination rectangle before the transform, texture
+    // coordinates, color, transform and where the vertices go.
+    DynArray<float> m_x0, m_y0, m_x1, m_y1;
+    DynArray<float> m_u0, m_v0, m_u1, m_v1;
+    DynArray<Color> m_color;
+    DynArray<int>   m_transformIndex;
+    DynArray<int>   m_firstVertex;
+
+    // The distinct transforms of the batch, in order of use.
+    DynArray<Transform> m_transforms;
+};
+
+// -----------------------------------------------------------
+// --    GLState utility class
+//
+//  The GL state Canvas sets while drawing, as it was last set,
+//  so calls that would change nothing are skipped and counted.
+//  Anything else that changes this state, such as Java uploading
+//  a texture or a new context, must be followed by Invalidate.
+// -----------------------------------------------------------
+class GLState
+{
+public:
+    GLState() {
+        avoided = 0;
+        Invalidate();
+    }
+
+    void Invalidate();
+
+    void BindArrayBuffer( unsigned int id );
+    void BindElementBuffer( unsigned int id );
+    void BindTexture( unsigned int id );
+    void DeleteBuffer( unsigned int id );
+    void DeleteTexture( unsigned int id );
+
+    void EnableTexture2D();
+    void EnableClientState( unsigned int array, bool enable );
+    void VertexPointer( unsigned int type, int stride, const void *pointer );
+    void TexCoordPointer( unsigned int type, int stride, const void *pointer );
+    void ColorPointer( int stride, const void *pointer );
+    void SetColor( const Color &color );
+    void ForgetColor() {
+        m_colorKnown = false;
+    }
+    void ClearColor( float red, float green, float blue );
+
+    int avoided;                // Calls skipped since last reset.
+
+private:
+    // A vertex array pointer, which also captures the array buffer
+    // bound when it was set.
+    struct Pointer {
+        unsigned int buffer;
+        unsigned int type;
+        int stride;
+        const void *pointer;
+    };
+    bool SetPointer( Pointer &p, unsigned int type, int stride, const void *pointer );
+
+    enum { kUnknown = 0xffffffff };
+    unsigned int m_arrayBuffer;
+    unsigned int m_elementBuffer;
+    unsigned int m_texture;
+    int     m_texture2D;        // -1 unknown, else enabled
+    int     m_vertexArray;
+    int     m_texCoordArray;
+    int     m_colorArray;
+    Pointer m_vertexPointer;
+    Pointer m_texCoordPointer;
+    Pointer m_colorPointer;
+    bool    m_colorKnown;
+    Color   m_color;
+    bool    m_clearColorKnown;
+    float   m_clearColor[3];
+};
+
 // -----------------------------------------------------------
 // --    Stream utility class
 //
 //  A stream is:
 //      - a reference to an Texture
-//      - a reference to vertex data on the GPU
+//      - a range of vertex data on the GPU
 //
 // As the render message is decoded, the streams are built up.
 // The render message is always decoded into the same working
-// memory buffer - vertexBuffer - and then transfered
-// to the VBO. No local copy is kept.
+// memory buffer - vertexBuffer - and the whole frame is then
+// transfered to one VBO in a single upload, packed where possible.
+// Each stream draws its own range of that VBO. No local copy is kept.
 // -----------------------------------------------------------
 
+class DisplayList;
+
 class Stream
 {
 public:
@@ -267,23 +520,73 @@ public:
 
     Stream( const Texture* img=0 ) {
         texture = img;
-        vboVertexID = 0;
-        nVBOAllocated = 0;
+        displayList = NULL;
+        vbo = 0;
+        vboOffset = 0;
+        firstVertex = 0;
         nVertex = 0;
         usesColor=false;
+        compact=false;
+        transform = Transform::Identity();
+        bounds[0] = bounds[1] = bounds[2] = bounds[3] = 0;
     }
 
     void Reset() {
         texture = NULL;
+        displayList = NULL;
+        nVertex = 0;
         usesColor=false;
     }
 
-    void VBOUpload( const DynArray<Vertex2>& buffer );
+    // Bytes per vertex as uploaded: position, texture coordinates and,
+    // only if usesColor, the color last.
+    int GetStride() const {
+        int stride = compact ? 4*sizeof(short) : 2*sizeof(Vector2);
+        return usesColor ? stride + sizeof(Color) : stride;
+    }
+
+    // A stream either draws its own vertices with texture, or replays
+    // displayList under transform and color.
+    const DisplayList *displayList; // We don't own this either.
+    Transform transform;
+    Color color;
 
-    unsigned int vboVertexID;
-    int  nVBOAllocated;
+    unsigned int vbo;       // Shared with the other streams of the frame or list.
+    int vboOffset;          // Byte offset of this stream's vertices in vbo.
+    int firstVertex;        // Offset of this stream's vertices while building.
     int	nVertex;
     bool		usesColor;
+    bool        compact;    // Uploaded as CompactVertex2.
+    float       bounds[4];  // minX, minY, maxX, maxY of the quads, when reordering.
+};
+
+// -----------------------------------------------------------
+// --    DisplayList utility class
+//
+//  Streams recorded once between begin/end display list commands
+//  and replayed by ID. The vertices of all its streams stay in the
+//  list's own VBO until the list is re-recorded or deleted.
+// -----------------------------------------------------------
+class DisplayList
+{
+public:
+    DisplayList( int listID ) {
+        id = listID;
+        vbo = 0;
+    }
+    ~DisplayList() {
+        for ( int i = 0; i < streams.GetSize(); i++) {
+            delete streams[i];
+        }
+    }
+
+    int id;
+    unsigned int vbo;
+    DynArray<Stream *> streams;
+
+private:
+    DisplayList(const DisplayList & that);                // private, undefined
+    DisplayList &operator = (const DisplayList &that);    // private, undefined
 };
 // -----------------------------------------------------------
 // --    CaptureParams struct
@@ -296,13 +599,38 @@ struct CaptureParams {
         ALLOCATED = 512
     };
 
+    // PNG compression presets, fastest first. FastCanvas.java
+    // passes these numbers.
+    enum Compression {
+        COMPRESS_STORE,     // No deflate at all; big files.
+        COMPRESS_FAST,      // One fixed filter, short match searches.
+        COMPRESS_DEFAULT,   // lodepng's defaults.
+        COMPRESS_BEST       // Full window and match searches; slow.
+    };
+
+    // Where the capture goes. The in-memory ones come back as the
+    // callback's data and ignore fileName.
+    enum Output {
+        OUTPUT_FILE,        // A PNG written to fileName.
+        OUTPUT_PNG,         // The PNG bytes.
+        OUTPUT_RGBA         // Width and height, then the pixels, top row first.
+    };
+
     CaptureParams();
-    CaptureParams(int x, int y, int w, int h, const char * callbackID, const char * fileName);
+    CaptureParams(int x, int y, int w, int h, const char * callbackID, const char * fileName,
+                  int compression = COMPRESS_DEFAULT, int output = OUTPUT_FILE,
+                  int thumbWidth = 0, int thumbHeight = 0);
 
     int x;
     int y;
     int width;
     int height;
+    int compression;
+    int output;
+    // Box filtered down to this size when set, but never scaled up.
+    // With only one of them set the other keeps the aspect ratio.
+    int thumbWidth;
+    int thumbHeight;
     char callbackID[ALLOCATED];
     char fileName[ALLOCATED];
 };
@@ -311,7 +639,8 @@ struct CaptureParams {
 // --    Callback struct
 //
 //  Contains the information needed to execute a success or error
-//  callback on the cordova side
+//  callback on the cordova side. A callback with data answers with
+//  those bytes instead of result.
 // -----------------------------------------------------------
 struct Callback {
     enum {
@@ -319,10 +648,249 @@ struct Callback {
     };
 
     Callback(const char * id, const char * res, bool error);
+    Callback(const char * id, unsigned char * bytes, size_t size);    // Takes bytes, malloc'ed.
+    ~Callback();
 
     char callbackID[ALLOCATED];
     char result[ALLOCATED];
     bool isError;
+    unsigned char *data;    // NULL unless the result is binary.
+    size_t dataSize;
+
+private:
+    Callback(const Callback & that);                // private, undefined
+    Callback &operator = (const Callback &that);    // private, undefined
+};
+
+#if defined(__ANDROID__)
+struct AAssetManager;
+struct AAsset;
+#endif
+
+// -----------------------------------------------------------
+// --    FileData utility class
+//
+//  The bytes of a file, mapped instead of copied where possible:
+//  APK assets through AAsset_getBuffer, which maps entries stored
+//  uncompressed, and files on disk through mmap. Compressed assets
+//  are inflated once by the asset manager.
+// -----------------------------------------------------------
+class FileData
+{
+public:
+    FileData();
+    ~FileData();
+
+#if defined(__ANDROID__)
+    bool    OpenAsset( AAssetManager *mgr, const char *path );
+#endif
+    bool    OpenFile( const char *path );
+    void    Close();
+
+    const unsigned char *GetData() const    { return m_data; }
+    long    GetSize() const                 { return m_size; }
+
+private:
+    FileData(const FileData & that);                // private, undefined
+    FileData &operator = (const FileData &that);    // private, undefined
+
+    const unsigned char *m_data;    // NULL unless open.
+    long    m_size;
+    void   *m_mapped;               // From mmap, or NULL.
+    unsigned char *m_allocated;     // Read into, if the asset can't be mapped.
+#if defined(__ANDROID__)
+    AAsset *m_asset;
+#endif
+};
+
+// -----------------------------------------------------------
+// --    StagingBuffer utility class
+//
+//  RGBA pixels laid out as the texture they will be uploaded
+//  to: a PNG is decoded straight into the top left of a buffer
+//  padded to a power of 2 each way, so it goes to GL in one
+//  glTexImage2D with no copy. The memory is kept for the next
+//  decode.
+// -----------------------------------------------------------
+class StagingBuffer
+{
+public:
+    StagingBuffer();
+    ~StagingBuffer();
+
+    // Returns the lodepng error, 0 on success. The padding is
+    // zeroed.
+    unsigned DecodePng( const unsigned char *png, long size );
+
+    // Frees the memory if it is more than kKeepBytes.
+    void    Trim();
+
+    const unsigned char *GetPixels() const  { return m_pixels; }
+    unsigned int GetWidth() const           { return m_width; }
+    unsigned int GetHeight() const          { return m_height; }
+    unsigned int GetPaddedWidth() const     { return m_paddedWidth; }
+    unsigned int GetPaddedHeight() const    { return m_paddedHeight; }
+    size_t  GetStride() const               { return m_paddedWidth * 4; }
+
+private:
+    StagingBuffer(const StagingBuffer & that);                // private, undefined
+    StagingBuffer &operator = (const StagingBuffer &that);    // private, undefined
+
+    enum { kKeepBytes = 1024 * 1024 * 4 };
+    unsigned char *m_pixels;
+    size_t  m_capacity;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_paddedWidth;
+    unsigned int m_paddedHeight;
+};
+
+// -----------------------------------------------------------
+// --    TextureLoad struct
+//
+//  A PNG on its way to becoming a texture. Owns the encoded
+//  file until it is decoded, then the staging buffer holding
+//  the decoded pixels.
+// -----------------------------------------------------------
+struct TextureLoad {
+    enum {
+        ALLOCATED = 512
+    };
+
+    // Takes ownership of png, which must come from new.
+    TextureLoad(int id, FileData *png, const char * callbackID);
+    ~TextureLoad();
+
+    int id;
+    FileData *png;              // NULL once decoded.
+    StagingBuffer *staging;     // NULL until decoded.
+    unsigned int error;         // lodepng error code, 0 on success.
+    bool cancelled;
+    char callbackID[ALLOCATED];
+};
+
+// -----------------------------------------------------------
+// --    TextureLoader utility class
+//
+//  Decodes PNGs on a pool of worker threads, so loading many
+//  textures doesn't stall the GL thread. Decoded loads wait
+//  until the GL thread takes them to upload. The threads are
+//  started by the first Queue. See TextureLoader.cpp.
+// -----------------------------------------------------------
+class TextureLoader
+{
+public:
+    TextureLoader();
+    ~TextureLoader();
+
+    // Takes ownership of load and decodes it on a worker.
+    void Queue( TextureLoad *load );
+
+    // The next decoded load, or NULL if none is ready yet. The
+    // caller owns it.
+    TextureLoad *TakeDecoded();
+
+    // Drops every load for id not yet taken.
+    void Cancel( int id );
+
+    // Deletes a load the caller is done with, keeping its staging
+    // buffer for a later decode.
+    void Recycle( TextureLoad *load );
+
+private:
+    TextureLoader(const TextureLoader & that);                // private, undefined
+    TextureLoader &operator = (const TextureLoader &that);    // private, undefined
+
+    void    Decode( TextureLoad *load );
+    static void *ThreadMain( void *arg );
+    void    Run();
+    void    StartThreads();
+
+    enum { kMaxThreads = 4 };
+    pthread_t m_threads[kMaxThreads];
+    int     m_numThreads;
+    bool    m_quit;
+
+    // Guards everything below.
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_wake;         // Signaled when m_pending grows or on quit.
+    DynArray<TextureLoad *> m_pending;      // Waiting for a worker.
+    DynArray<TextureLoad *> m_decoding;     // Held by a worker.
+    DynArray<TextureLoad *> m_decoded;      // Waiting for TakeDecoded.
+    DynArray<StagingBuffer *> m_spare;      // At most kMaxThreads.
+};
+
+
+// -----------------------------------------------------------
+// --    CaptureJob struct
+//
+//  The pixels read back for a capture, on their way to a PNG
+//  file or the capture's callback.
+// -----------------------------------------------------------
+struct CaptureJob {
+    // Takes ownership of params.
+    CaptureJob(CaptureParams *params);
+    ~CaptureJob();
+
+    CaptureParams *params;
+    unsigned char *pixels;      // RGBA, bottom row first as glReadPixels gives them.
+    size_t capacity;            // Bytes allocated at pixels.
+    int width;
+    int height;
+};
+
+class Canvas;
+
+// -----------------------------------------------------------
+// --    CaptureWriter utility class
+//
+//  Flips, scales, encodes and writes captures on a worker thread, so
+//  the GL thread only reads the pixels back and rendering goes
+//  on while the PNG is written. Each finished capture adds its
+//  callback to the canvas, carrying the bytes themselves for the
+//  in-memory outputs. The thread is started by the first
+//  Queue. See CaptureWriter.cpp.
+// -----------------------------------------------------------
+class CaptureWriter
+{
+public:
+    CaptureWriter(Canvas *canvas);
+    ~CaptureWriter();
+
+    // A job with room for width x height pixels, reusing the
+    // spare buffer if it is big enough. NULL if out of memory;
+    // params is then still the caller's.
+    CaptureJob *NewJob( CaptureParams *params, int width, int height );
+
+    // Takes ownership of job and writes it on the worker.
+    void    Queue( CaptureJob *job );
+
+    // Drops the queued jobs and waits for the one being written.
+    void    Stop();
+
+private:
+    CaptureWriter(const CaptureWriter & that);                // private, undefined
+    CaptureWriter &operator = (const CaptureWriter &that);    // private, undefined
+
+    enum { kRgbaHeaderBytes = 8 };
+
+    void    Write( CaptureJob *job );
+    void    WriteRgba( CaptureJob *job, int width, int height );
+    void    Recycle( CaptureJob *job );
+    static void *ThreadMain( void *arg );
+    void    Run();
+
+    Canvas *m_canvas;
+    pthread_t m_thread;
+    bool    m_started;
+
+    // Guards everything below.
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_wake;         // Signaled when m_pending grows or on quit.
+    bool    m_quit;
+    DynArray<CaptureJob *> m_pending;
+    unsigned char *m_spare;         // One buffer kept for the next capture.
+    size_t  m_spareCapacity;
 };
 
 
@@ -341,23 +909,47 @@ public:
     void SetOrtho(int width, int height);
     void AddTexture(int id, int glID, int width, int height);
     bool AddPngTexture(const unsigned char *buffer, long size, int id, unsigned int *pWidth, unsigned int *pHeight);
+    // Decodes on a worker thread and uploads in a later Render. Takes
+    // ownership of png, which must come from new. The callback gets
+    // "width,height" or the decoder's error.
+    void QueuePngTexture(FileData *png, int id, const char * callbackID);
+    void SetTextureAtlas(bool enabled);
+    void SetViewportCulling(bool enabled);
+    void SetBatchReordering(bool enabled);
     void RemoveTexture(int id);
     void Render(const char *renderCommands, int length);
-    void QueueCaptureGLLayer(int x, int y, int w, int h, const char * callbackID, const char * fn);
+    void RenderBinary(const unsigned char *renderCommands, int length);
+    void QueueCaptureGLLayer(int x, int y, int w, int h, const char * callbackID, const char * fn,
+                             int compression = CaptureParams::COMPRESS_DEFAULT,
+                             int output = CaptureParams::OUTPUT_FILE,
+                             int thumbWidth = 0, int thumbHeight = 0);
 
     //callback helper functions
     Callback * GetNextCallback(); //return front of callback queue
     void PopCallbacks(); //delete front of callback queue
     void AddCallback(const char * callbackID, const char * result, bool isError);
+    void AddCallback(const char * callbackID, unsigned char * data, size_t size); //takes data, malloc'ed
 
     // Currently in either platform on C++
     void OnSurfaceChanged( int width, int height );
 
+    // Locale independent number parsing for the grammar FastCanvas.js emits:
+    // [sign] digits [. digits] [e [sign] digits]. *end is set to the first
+    // character not consumed, or to str if no number was found.
+    static float FastFloat( const char *str, const char **end );
+    static int  FastInt( const char *str, const char **end );
+
 private:
     Canvas(); // Called by GetCanvas()
     ~Canvas(); // Called by Release()
 
+    void    BuildFrame(const void *renderCommands, int length, bool binary);
+    bool    IsRepeatFrame(const void *renderCommands, int length, bool binary);
     void    BuildStreams(const char *renderCommands, int length);
+    void    BuildStreamsBinary(const unsigned char *renderCommands, int length);
+    void    BeginStreams(int length);
+    void    EndStreams();
+    void    DrawFrame();
     void	DoSetOrtho(int width, int height);
     void	DoContextLost();
 
@@ -369,8 +961,19 @@ private:
 //        return false;
     }
 
+    // Indices are 16 bit, so a stream can address at most 65536 vertices.
+    // Streams that would grow past this are split, and the next one
+    // starts over at index 0.
+    enum { kMaxStreamVertices = 65536 };
     void    EnsureIndex( int index );
-    bool CaptureGLLayer(CaptureParams * params);
+    bool    AddAtlasTexture( const unsigned char *pixels, int width, int height, size_t stride, int id );
+    void    UploadTexture( const StagingBuffer &staging, int id, unsigned int *pWidth, unsigned int *pHeight );
+    void    UploadDecodedTextures();
+    void    RegisterTexture( Texture *img );
+    void    DestroyTexture( int id );
+    const Texture* FindTexture( int id ) const;
+    AtlasPage* FindAtlasPage( int glID, int *pIndex );
+    void CaptureGLLayer(CaptureParams * params);
     enum {
         IDENTITY,           // rt
         SET_XFORM,          // st
@@ -380,6 +983,20 @@ private:
         NUM_PARSE_MODES
     };
 
+    // Binary render commands use the same opcodes as the text protocol,
+    // one byte each, followed by packed little-endian operands:
+    //      t, f        6 x float32     (a, b, c, d, tx, ty)
+    //      k, l        2 x float32
+    //      r, a        1 x float32
+    //      d           int32 textureID, 8 x float32 (cx, cy, cw, ch, px, py, pw, ph)
+    //      b, c, x     int32 display list ID
+    //      m, v, e, n  no operands
+    // Operands are not aligned.
+    enum {
+        NUM_XFORM_TOKENS = 6,
+        NUM_CLIP_TOKENS = 8
+    };
+
     const char* ParseSetTransform( const char *renderCommands,
                                    int parseMode,               // what to read: IDENTITY, FULL_XFORM, etc.
                                    bool concat,                 // if true, concatenate, else replace.
@@ -388,15 +1005,31 @@ private:
 
     const char* ParseDrawImage( const char *renderCommands, Clip *clipOut);
     const char* ParseUnknown( const char *renderCommands );
-    void    DoPushQuad( Stream* stream, const Transform &transform, const Clip &clip);
+    void    DoSetTransform( const float *tokens, int parseMode, bool concat, Transform transIn, Transform *transOut );
+    void    DoSave();
+    void    DoRestore();
+    void    DoGlobalAlpha( float alpha );
+    void    DoDrawImage( const Clip &clip );
+    void    DoBeginDisplayList( int id );
+    void    DoEndDisplayList();
+    void    DoCallDisplayList( int id );
+    void    DoDeleteDisplayList( int id );
+    void    FlushStream();
+    void    UploadStreams( unsigned int *vbo, Stream *const *streams, int count, const Vertex2 *vertices, unsigned int usage );
+    DisplayList* FindDisplayList( int id );
+    void    DrawStream( const Stream *stream );
+    void    SetCompactTexMatrix( bool compact );
+    void    DrawDisplayList( const Stream *call );
+    void    DoPushQuad( Stream* stream, const Texture *texture, const Transform &transform, const Clip &clip);
+    void    ExpandQuads();
+    Stream* NextStream( DynArray<Stream *> &streams, int &n, const Texture *img );
+    void    DoDrawImageReordered( const Texture *img, const Clip &clip );
+    int     FindReorderStream( const Texture *img, const float *bounds ) const;
+    void    LayoutReorderedStreams();
+    void    GetQuadBounds( const Transform &transform, const Clip &clip, float *bounds ) const;
+    bool    IsQuadVisible( const Transform &transform, const Clip &clip ) const;
     void    RenderText( const char* format, ... );
 
-    float   FastFloat( const char *str )    {
-        return (float)atof( str );
-    }
-    int FastInt( const char *str )      {
-        return atoi( str );
-    }
     void UpdateFrameRate();
 
     // Members
@@ -419,6 +1052,25 @@ private:
     float	m_mps;
     int     m_msgLen;
     float   m_bytesPS;
+    int     m_skippedBuilds;
+    int     m_culledQuads;      // Quads dropped and kept by culling in the last built frame.
+    int     m_submittedQuads;
+
+    // Draws entirely outside the ortho rectangle are dropped while
+    // building, except while recording a display list, whose transform
+    // at replay isn't known yet.
+    bool    m_cullingEnabled;
+
+    // Optionally, a draw can join an earlier stream with its texture
+    // instead of starting a new one, if it doesn't overlap any draw in
+    // between. Quads then only get their place in m_vertexBuffer once
+    // the streams are laid out, at the end of the frame or when a
+    // display list begins. Display list calls are not moved across.
+    enum { kReorderLookback = 16 };     // Streams searched back for a match.
+    bool    m_reorderEnabled;
+    int     m_reorderFirst;             // First stream not yet laid out.
+    DynArray<int> m_reorderQuadStreams; // Stream of each queued quad.
+    DynArray<int> m_reorderFill;        // Next vertex of each stream during layout.
 #ifdef USE_INDEX_BUFFER
     unsigned int m_indexVBO;
 #endif
@@ -433,14 +1085,81 @@ private:
     // For the save/restore behavior.
     DynArray<Transform> m_transformStack;
 
-    // Local scratch buffer for building streams.
+    // Draws whose vertices are reserved in m_vertexBuffer but not yet
+    // written. Expanded before anything reads the vertices, and every
+    // kMaxQuadBatch quads so the batch stays in cache.
+    enum { kMaxQuadBatch = 1024 };
+    QuadBatch m_quadBatch;
+
+    // Local scratch buffer for building streams. Holds the vertices of
+    // every stream in the frame; m_streamStart is where the open stream's
+    // vertices begin, so the stream is open while the buffer is longer.
     DynArray<Vertex2> m_vertexBuffer;
+    int     m_streamStart;
+
+    // Frame vertices are uploaded once per built frame into the next of
+    // these buffers in turn, so the CPU never writes to a buffer the GPU
+    // may still be reading from an earlier frame.
+    enum { kNumFrameVBOs = 3 };
+    unsigned int m_frameVBOs[kNumFrameVBOs];
+    int     m_frameVBOIndex;
+
+    // Vertices in the layout they are uploaded in, see Stream::GetStride.
+    DynArray<unsigned char> m_uploadBuffer;
+    // Whether the texture matrix is set up for CompactVertex2.
+    bool    m_compactTexMatrix;
+
+    GLState m_glState;
+    int     m_avoidedGLCalls;   // Skipped by m_glState in the last frame drawn.
+    Color   m_drawColor;        // For streams without vertex colors.
+
+    // The last frame that was built, so an identical one can reuse the
+    // streams already on the GPU. Only kept when the transform stack was
+    // empty before and after the frame, so the start and end transforms
+    // are all the state it depends on.
+    DynArray<unsigned char> m_lastFrame;
+    bool        m_lastFrameValid;
+    bool        m_lastFrameBinary;
+    Transform   m_lastFrameStart;
+    Transform   m_lastFrameEnd;
+    bool        m_frameCacheable;   // Cleared by commands that can't be skipped on repeat.
 
     DynArray<Stream *> m_streams;
+    int     m_streamIndex;      // Stream currently being built, -1 if none.
+
+    DynArray<DisplayList *> m_displayLists;
+    DisplayList *m_recording;   // List being recorded, or NULL.
+    int     m_recordIndex;      // Stream of m_recording being built, -1 if none.
+    int     m_recordFirstVertex;    // Where m_recording's vertices begin in m_vertexBuffer.
     DynArray<Texture *> m_textures;
+
+    // Textures indexed by ID for the lookup on every drawImage. JS hands
+    // out small sequential IDs; anything outside the table falls back to
+    // a scan of m_textures.
+    enum { kTextureTableSize = 4096 };
+    DynArray<Texture *> m_textureTable;
+
+    // Optional packing of small PNG textures into shared pages.
+    enum {
+        kAtlasPageSize = 1024,
+        kAtlasMaxTextureSize = 256,     // Larger images get their own texture.
+        kAtlasPadding = 1               // Edge texels repeated around each image.
+    };
+    bool m_atlasEnabled;
+    DynArray<AtlasPage *> m_atlasPages;
     DynArray<CaptureParams *> m_capParams;
+    CaptureWriter m_captureWriter;
+
+    // m_captureWriter's thread adds callbacks too.
+    pthread_mutex_t m_callbackMutex;
     DynArray<Callback *> m_callbacks;
 
+    // PNGs decoding in the background. Each Render uploads those that
+    // are done for up to kTextureUploadBudgetMs, and at least one.
+    enum { kTextureUploadBudgetMs = 4 };
+    TextureLoader m_textureLoader;
+    StagingBuffer m_staging;    // For AddPngTexture, which decodes on the GL thread.
+
 #ifdef USE_INDEX_BUFFER
     // The indices are the same for every call.
     // BASCC only renders quads, so these can be re-used.
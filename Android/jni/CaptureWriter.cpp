@@ -0,0 +1,564 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Canvas.h"
+#include <unistd.h>
+extern "C" {
+#include "lodepng.h"
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#   define USE_NEON_THUMBS
+#   include <arm_neon.h>
+#elif defined(__SSE2__)
+#   define USE_SSE2_THUMBS
+#   include <emmintrin.h>
+#endif
+
+CaptureJob::CaptureJob(CaptureParams *captureParams)
+{
+    params = captureParams;
+    pixels = NULL;
+    capacity = 0;
+    width = 0;
+    height = 0;
+}
+
+CaptureJob::~CaptureJob()
+{
+    delete params;
+    if (pixels) {
+        free(pixels);
+    }
+}
+
+//---------------------------------------------------------------
+
+// One piece of a parallel deflate: in[dictSize..size-1] is the
+// piece, what is before it the dictionary.
+struct DeflatePiece
+{
+    const unsigned char *in;
+    size_t  dictSize;
+    size_t  size;
+    int     final;
+    const LodePNGCompressSettings *settings;
+    unsigned char *out;
+    size_t  outSize;
+    unsigned adler;
+    unsigned error;
+};
+
+static void DeflatePiece_Run( DeflatePiece *piece )
+{
+    piece->error = lodepng_deflate_chunk( &piece->out, &piece->outSize, piece->in,
+                                          piece->dictSize, piece->size, piece->final,
+                                          piece->settings );
+    piece->adler = lodepng_adler32( piece->in + piece->dictSize, piece->size - piece->dictSize );
+}
+
+static void *DeflatePiece_ThreadMain( void *arg )
+{
+    DeflatePiece_Run( (DeflatePiece *)arg );
+    return NULL;
+}
+
+// lodepng's custom_zlib for big captures. The filtered scanlines
+// are cut into one piece per core, each deflated on its own thread
+// with the window before it as dictionary and ending on a byte
+// boundary, so the pieces join into a single deflate stream. That
+// costs a few bytes per piece and keeps it a standard PNG.
+static unsigned ParallelZlib( unsigned char **out, size_t *outSize,
+                              const unsigned char *in, size_t inSize,
+                              const LodePNGCompressSettings *settings )
+{
+    enum { kMaxPieces = 8, kMinPieceBytes = 256 * 1024 };
+
+    long cores = sysconf( _SC_NPROCESSORS_ONLN );
+    size_t count = inSize / kMinPieceBytes;
+    if (cores > 0 && count > (size_t)cores) count = (size_t)cores;
+    if (count > kMaxPieces) count = kMaxPieces;
+    if (count < 2) {
+        return lodepng_zlib_compress( out, outSize, in, inSize, settings );
+    }
+
+    DeflatePiece pieces[kMaxPieces];
+    pthread_t threads[kMaxPieces];
+    bool started[kMaxPieces];
+    size_t step = inSize / count;
+    for (size_t i = 0; i < count; i++) {
+        size_t start = i * step;
+        size_t end = i == count - 1 ? inSize : start + step;
+        size_t dict = start < settings->windowsize ? start : settings->windowsize;
+        DeflatePiece *piece = &pieces[i];
+        piece->in = in + start - dict;
+        piece->dictSize = dict;
+        piece->size = end - start + dict;
+        piece->final = i == count - 1;
+        piece->settings = settings;
+        piece->out = NULL;
+        piece->outSize = 0;
+    }
+
+    // The calling thread takes the first piece itself.
+    for (size_t i = 1; i < count; i++) {
+        started[i] = pthread_create( &threads[i], NULL, DeflatePiece_ThreadMain, &pieces[i] ) == 0;
+    }
+    DeflatePiece_Run( &pieces[0] );
+    for (size_t i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join( threads[i], NULL );
+        } else {
+            DeflatePiece_Run( &pieces[i] );
+        }
+    }
+
+    // The same 2 byte header lodepng_zlib_compress writes, then the
+    // pieces and the Adler32 of all of in, big endian.
+    unsigned error = 0;
+    size_t total = 2 + 4;
+    unsigned adler = 1;
+    for (size_t i = 0; i < count; i++) {
+        if (pieces[i].error && !error) {
+            error = pieces[i].error;
+        }
+        total += pieces[i].outSize;
+        adler = lodepng_adler32_combine( adler, pieces[i].adler,
+                                         pieces[i].size - pieces[i].dictSize );
+    }
+
+    unsigned char *zlib = NULL;
+    if (!error) {
+        zlib = (unsigned char *)malloc( total );
+        if (!zlib) {
+            error = 83; // lodepng's "memory allocation failed"
+        }
+    }
+    if (zlib) {
+        unsigned char *p = zlib;
+        *p++ = 0x78;
+        *p++ = 0x01;
+        for (size_t i = 0; i < count; i++) {
+            memcpy( p, pieces[i].out, pieces[i].outSize );
+            p += pieces[i].outSize;
+        }
+        *p++ = (unsigned char)(adler >> 24);
+        *p++ = (unsigned char)(adler >> 16);
+        *p++ = (unsigned char)(adler >> 8);
+        *p++ = (unsigned char)adler;
+        free( *out );
+        *out = zlib;
+        *outSize = total;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free( pieces[i].out );
+    }
+    return error;
+}
+
+//---------------------------------------------------------------
+
+// The size a capture goes out at: the thumbnail size if one was
+// asked for, within the captured size.
+static void OutputSize( const CaptureParams *params, int width, int height,
+                        int *outWidth, int *outHeight )
+{
+    int w = params->thumbWidth;
+    int h = params->thumbHeight;
+    if ((w <= 0 && h <= 0) || width <= 0 || height <= 0) {
+        *outWidth = width;
+        *outHeight = height;
+        return;
+    }
+    if (w <= 0) {
+        w = (int)((long long)width * h / height);
+    } else if (h <= 0) {
+        h = (int)((long long)height * w / width);
+    }
+    *outWidth = w < 1 ? 1 : w > width ? width : w;
+    *outHeight = h < 1 ? 1 : h > height ? height : h;
+}
+
+// Adds a row of bytes to 32 bit sums, sixteen at a time.
+static inline void AddRow( unsigned int *sums, const unsigned char *row, size_t size )
+{
+    size_t i = 0;
+#if defined(USE_SSE2_THUMBS)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128( (const __m128i *)(row + i) );
+        __m128i lo = _mm_unpacklo_epi8( x, zero );
+        __m128i hi = _mm_unpackhi_epi8( x, zero );
+        __m128i *s = (__m128i *)(sums + i);
+        _mm_storeu_si128( s, _mm_add_epi32( _mm_loadu_si128( s ), _mm_unpacklo_epi16( lo, zero )));
+        _mm_storeu_si128( s + 1, _mm_add_epi32( _mm_loadu_si128( s + 1 ), _mm_unpackhi_epi16( lo, zero )));
+        _mm_storeu_si128( s + 2, _mm_add_epi32( _mm_loadu_si128( s + 2 ), _mm_unpacklo_epi16( hi, zero )));
+        _mm_storeu_si128( s + 3, _mm_add_epi32( _mm_loadu_si128( s + 3 ), _mm_unpackhi_epi16( hi, zero )));
+    }
+#elif defined(USE_NEON_THUMBS)
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t x = vld1q_u8( row + i );
+        uint16x8_t lo = vmovl_u8( vget_low_u8( x ));
+        uint16x8_t hi = vmovl_u8( vget_high_u8( x ));
+        unsigned int *s = sums + i;
+        vst1q_u32( s, vaddw_u16( vld1q_u32( s ), vget_low_u16( lo )));
+        vst1q_u32( s + 4, vaddw_u16( vld1q_u32( s + 4 ), vget_high_u16( lo )));
+        vst1q_u32( s + 8, vaddw_u16( vld1q_u32( s + 8 ), vget_low_u16( hi )));
+        vst1q_u32( s + 12, vaddw_u16( vld1q_u32( s + 12 ), vget_high_u16( hi )));
+    }
+#endif
+    for (; i < size; i++) {
+        sums[i] += row[i];
+    }
+}
+
+// Adds up the RGBA sums of pixels x0 to x1 - 1, one pixel per vector.
+static inline void AddPixels( const unsigned int *sums, int x0, int x1, unsigned int *total )
+{
+    int x = x0;
+#if defined(USE_SSE2_THUMBS)
+    __m128i t = _mm_setzero_si128();
+    for (; x < x1; x++) {
+        t = _mm_add_epi32( t, _mm_loadu_si128( (const __m128i *)(sums + x * 4) ));
+    }
+    _mm_storeu_si128( (__m128i *)total, t );
+#elif defined(USE_NEON_THUMBS)
+    uint32x4_t t = vdupq_n_u32( 0 );
+    for (; x < x1; x++) {
+        t = vaddq_u32( t, vld1q_u32( sums + x * 4 ));
+    }
+    vst1q_u32( total, t );
+#else
+    total[0] = total[1] = total[2] = total[3] = 0;
+    for (; x < x1; x++) {
+        for (int c = 0; c < 4; c++) {
+            total[c] += sums[x * 4 + c];
+        }
+    }
+#endif
+}
+
+// Box filters the pixels as glReadPixels gives them, bottom row
+// first, down to a smaller size at dst, top row first, so the flip
+// costs nothing extra. Each destination pixel is the rounded mean
+// of the block of source pixels that maps onto it; the rows of a
+// block are summed first, then the columns. False if out of memory.
+static bool BoxFilterFlipped( const unsigned char *src, int srcWidth, int srcHeight,
+                              unsigned char *dst, int dstWidth, int dstHeight )
+{
+    size_t srcRowBytes = (size_t)srcWidth * 4;
+    unsigned int *sums = (unsigned int *)malloc( srcRowBytes * sizeof(unsigned int) );
+    if (!sums) {
+        return false;
+    }
+
+    for (int dy = 0; dy < dstHeight; dy++) {
+        int y0 = (int)((long long)dy * srcHeight / dstHeight);
+        int y1 = (int)((long long)(dy + 1) * srcHeight / dstHeight);
+        memset( sums, 0, srcRowBytes * sizeof(unsigned int) );
+        for (int y = y0; y < y1; y++) {
+            AddRow( sums, src + (size_t)(srcHeight - 1 - y) * srcRowBytes, srcRowBytes );
+        }
+
+        unsigned char *out = dst + (size_t)dy * dstWidth * 4;
+        for (int dx = 0; dx < dstWidth; dx++) {
+            int x0 = (int)((long long)dx * srcWidth / dstWidth);
+            int x1 = (int)((long long)(dx + 1) * srcWidth / dstWidth);
+            unsigned int count = (unsigned int)((x1 - x0) * (y1 - y0));
+            unsigned int total[4];
+            AddPixels( sums, x0, x1, total );
+            for (int c = 0; c < 4; c++) {
+                out[dx * 4 + c] = (unsigned char)((total[c] + count / 2) / count);
+            }
+        }
+    }
+
+    free( sums );
+    return true;
+}
+
+// Flips full size pixels in place to top row first.
+static bool FlipRows( unsigned char *pixels, int width, int height )
+{
+    size_t rowBytes = (size_t)width * 4;
+    unsigned char *row = (unsigned char *)malloc( rowBytes > 0 ? rowBytes : 1 );
+    if (!row) {
+        return false;
+    }
+    for (int y = 0; y < height / 2; y++) {
+        unsigned char *top = pixels + y * rowBytes;
+        unsigned char *bottom = pixels + (height - y - 1) * rowBytes;
+        memcpy( row, top, rowBytes );
+        memcpy( top, bottom, rowBytes );
+        memcpy( bottom, row, rowBytes );
+    }
+    free( row );
+    return true;
+}
+
+//---------------------------------------------------------------
+
+// Maps a CaptureParams::Compression preset onto lodepng's settings.
+// Captures are opaque RGBA and go out as such in the fast presets,
+// skipping the scan of every pixel for a smaller color type.
+static void SetCompression( LodePNGEncoderSettings *settings, int compression )
+{
+    LodePNGCompressSettings *zlib = &settings->zlibsettings;
+    switch (compression) {
+    case CaptureParams::COMPRESS_STORE:
+        settings->auto_convert = LAC_NO;
+        settings->filter_strategy = LFS_ZERO;
+        zlib->btype = 0;
+        zlib->use_lz77 = 0;
+        return;     // Nothing to gain from more threads.
+    case CaptureParams::COMPRESS_FAST:
+        settings->auto_convert = LAC_NO;
+        settings->filter_strategy = LFS_FIXED;
+        settings->fixed_filter = 4;     // Paeth suits most game screens.
+        zlib->windowsize = 2048;
+        zlib->maxchainlength = 8;
+        zlib->nicematch = 32;
+        zlib->lazymatching = 0;
+        break;
+    case CaptureParams::COMPRESS_BEST:
+        zlib->windowsize = 32768;
+        zlib->nicematch = 258;
+        break;
+    default:
+        break;
+    }
+    zlib->custom_zlib = ParallelZlib;
+}
+
+//---------------------------------------------------------------
+
+CaptureWriter::CaptureWriter(Canvas *canvas)
+{
+    m_canvas = canvas;
+    m_started = false;
+    m_quit = false;
+    m_spare = NULL;
+    m_spareCapacity = 0;
+    pthread_mutex_init( &m_mutex, NULL );
+    pthread_cond_init( &m_wake, NULL );
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Stop();
+    if (m_spare) {
+        free( m_spare );
+    }
+    pthread_cond_destroy( &m_wake );
+    pthread_mutex_destroy( &m_mutex );
+}
+
+void CaptureWriter::Stop()
+{
+    pthread_mutex_lock( &m_mutex );
+    m_quit = true;
+    pthread_cond_signal( &m_wake );
+    pthread_mutex_unlock( &m_mutex );
+
+    if (m_started) {
+        pthread_join( m_thread, NULL );
+        m_started = false;
+    }
+
+    for (int i = 0; i < m_pending.GetSize(); i++) {
+        delete m_pending[i];
+    }
+    m_pending.SetSize( 0 );
+}
+
+CaptureJob *CaptureWriter::NewJob( CaptureParams *params, int width, int height )
+{
+    size_t needed = (size_t)width * height * 4;
+    unsigned char *pixels = NULL;
+    size_t capacity = 0;
+
+    pthread_mutex_lock( &m_mutex );
+    if (m_spare && m_spareCapacity >= needed) {
+        pixels = m_spare;
+        capacity = m_spareCapacity;
+        m_spare = NULL;
+        m_spareCapacity = 0;
+    }
+    pthread_mutex_unlock( &m_mutex );
+
+    if (!pixels) {
+        pixels = (unsigned char *)malloc( needed > 0 ? needed : 1 );
+        capacity = needed;
+        if (!pixels) {
+            return NULL;
+        }
+    }
+
+    CaptureJob *job = new CaptureJob( params );
+    job->pixels = pixels;
+    job->capacity = capacity;
+    job->width = width;
+    job->height = height;
+    return job;
+}
+
+void CaptureWriter::Queue( CaptureJob *job )
+{
+    pthread_mutex_lock( &m_mutex );
+    if (!m_started && !m_quit) {
+        m_started = pthread_create( &m_thread, NULL, ThreadMain, this ) == 0;
+    }
+    if (!m_started) {
+        // Without the worker the capture would never be written; do it here.
+        pthread_mutex_unlock( &m_mutex );
+        Write( job );
+        return;
+    }
+    m_pending.Append( &job, 1 );
+    pthread_cond_signal( &m_wake );
+    pthread_mutex_unlock( &m_mutex );
+}
+
+// Called without m_mutex held.
+void CaptureWriter::Write( CaptureJob *job )
+{
+    CaptureParams *params = job->params;
+    int width, height;
+    OutputSize( params, job->width, job->height, &width, &height );
+    if (params->output == CaptureParams::OUTPUT_RGBA) {
+        WriteRgba( job, width, height );
+        return;
+    }
+
+    // glReadPixels gives the bottom row first; PNGs start at the top.
+    unsigned char *image = NULL;
+    unsigned char *thumb = NULL;
+    if (width != job->width || height != job->height) {
+        thumb = (unsigned char *)malloc( (size_t)width * height * 4 );
+        if (thumb && BoxFilterFlipped( job->pixels, job->width, job->height, thumb, width, height )) {
+            image = thumb;
+        }
+    } else if (FlipRows( job->pixels, width, height )) {
+        image = job->pixels;
+    }
+
+    unsigned error = 83; // lodepng's "memory allocation failed"
+    unsigned char *png = NULL;
+    size_t pngSize = 0;
+    if (image) {
+        LodePNGState state;
+        lodepng_state_init( &state );
+        SetCompression( &state.encoder, params->compression );
+        error = lodepng_encode( &png, &pngSize, image, width, height, &state );
+        lodepng_state_cleanup( &state );
+        if (!error && params->output == CaptureParams::OUTPUT_FILE) {
+            error = lodepng_save_file( png, pngSize, params->fileName );
+        }
+    }
+    free( thumb );
+
+    if (error) {
+        m_canvas->AddCallback( params->callbackID, lodepng_error_text(error), true );
+        free( png );
+    } else if (params->output == CaptureParams::OUTPUT_PNG) {
+        m_canvas->AddCallback( params->callbackID, png, pngSize );
+    } else {
+        m_canvas->AddCallback( params->callbackID, params->fileName, false );
+        free( png );
+    }
+    Recycle( job );
+}
+
+// The rows are flipped, or filtered down, straight into the
+// callback's data, behind the width and height as little endian
+// 32 bit numbers, which FastCanvas.js reads back.
+void CaptureWriter::WriteRgba( CaptureJob *job, int width, int height )
+{
+    size_t rowBytes = (size_t)width * 4;
+    size_t size = kRgbaHeaderBytes + rowBytes * height;
+    unsigned char *data = (unsigned char *)malloc( size );
+    bool scaled = width != job->width || height != job->height;
+    if (data && scaled
+        && !BoxFilterFlipped( job->pixels, job->width, job->height, data + kRgbaHeaderBytes, width, height )) {
+        free( data );
+        data = NULL;
+    }
+    if (!data) {
+        m_canvas->AddCallback( job->params->callbackID, "Unable to allocate buffer", true );
+        Recycle( job );
+        return;
+    }
+
+    unsigned int dims[2] = { (unsigned int)width, (unsigned int)height };
+    for (int i = 0; i < 2; i++) {
+        for (int b = 0; b < 4; b++) {
+            data[i * 4 + b] = (unsigned char)(dims[i] >> (b * 8));
+        }
+    }
+    if (!scaled) {
+        for (int y = 0; y < height; y++) {
+            memcpy( data + kRgbaHeaderBytes + y * rowBytes,
+                    job->pixels + (height - y - 1) * rowBytes, rowBytes );
+        }
+    }
+
+    m_canvas->AddCallback( job->params->callbackID, data, size );
+    Recycle( job );
+}
+
+// Keeps the biggest buffer for the next capture, which is usually
+// the same size.
+void CaptureWriter::Recycle( CaptureJob *job )
+{
+    pthread_mutex_lock( &m_mutex );
+    if (job->capacity > m_spareCapacity) {
+        unsigned char *old = m_spare;
+        m_spare = job->pixels;
+        m_spareCapacity = job->capacity;
+        job->pixels = old;
+    }
+    pthread_mutex_unlock( &m_mutex );
+    delete job;
+}
+
+/*static*/
+void *CaptureWriter::ThreadMain( void *arg )
+{
+    ((CaptureWriter *)arg)->Run();
+    return NULL;
+}
+
+void CaptureWriter::Run()
+{
+    pthread_mutex_lock( &m_mutex );
+    for (;;) {
+        while (!m_quit && m_pending.IsEmpty()) {
+            pthread_cond_wait( &m_wake, &m_mutex );
+        }
+        if (m_quit) {
+            break;
+        }
+
+        CaptureJob *job = m_pending[0];
+        m_pending.RemoveAt(0);
+        pthread_mutex_unlock( &m_mutex );
+
+        Write( job );
+
+        pthread_mutex_lock( &m_mutex );
+    }
+    pthread_mutex_unlock( &m_mutex );
+}
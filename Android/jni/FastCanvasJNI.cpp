@@ -49,33 +49,38 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_addTexture
     }
 }
 
+// Absolute paths are files on disk, anything else is an APK asset.
+static bool OpenPng(JNIEnv *je, jobject assetManager, jstring path, FileData *file)
+{
+    const char *p = je->GetStringUTFChars(path, 0);
+    bool opened = false;
+    if (p[0] == '/') {
+        opened = file->OpenFile(p);
+    } else {
+        AAssetManager* mgr = AAssetManager_fromJava(je, assetManager);
+        if (mgr != NULL) {
+            opened = file->OpenAsset(mgr, p);
+        }
+    }
+    je->ReleaseStringUTFChars(path, p);
+    return opened;
+}
+
 JNIEXPORT jboolean JNICALL Java_com_adobe_plugins_FastCanvasJNI_addPngTexture
   (JNIEnv *je, jclass jc, jobject assetManager, jstring path, jint id, jobject dim)
 {
 	bool success = false;
     Canvas *theCanvas = Canvas::GetCanvas();
     if (theCanvas) {
-		AAssetManager* mgr = AAssetManager_fromJava(je, assetManager);
-		if (mgr == NULL) return false;
-
-        const char *p = je->GetStringUTFChars(path, 0);
-		AAsset* asset = AAssetManager_open(mgr, p, AASSET_MODE_UNKNOWN);
-        je->ReleaseStringUTFChars(path, p);
-		if (asset == NULL) return false;
-
-		long size = AAsset_getLength(asset);
-		unsigned char* buffer = (unsigned char*) malloc (size);
-		if (buffer == NULL) return false;
-
-		AAsset_read (asset, buffer, size);
-		AAsset_close(asset);
+		FileData file;
+		if (!OpenPng(je, assetManager, path, &file)) return false;
 
 		unsigned int width;
 		unsigned int height;
-        success = theCanvas->AddPngTexture(buffer, size, id, &width, &height);
-		free (buffer);
+        success = theCanvas->AddPngTexture(file.GetData(), file.GetSize(), id, &width, &height);
 
-		if (success) {
+		// Reloads after a lost context pass no dim.
+		if (success && dim != NULL) {
 			jclass cls = je->GetObjectClass(dim);  
 			jfieldID wID = je->GetFieldID(cls, "width", "I");
 			je->SetIntField(dim, wID, (int)width);
@@ -86,6 +91,53 @@ JNIEXPORT jboolean JNICALL Java_com_adobe_plugins_FastCanvasJNI_addPngTexture
 	return success;
 }
 
+JNIEXPORT jboolean JNICALL Java_com_adobe_plugins_FastCanvasJNI_queuePngTexture
+  (JNIEnv *je, jclass jc, jobject assetManager, jstring path, jint id, jstring callbackID)
+{
+    Canvas *theCanvas = Canvas::GetCanvas();
+    if (theCanvas) {
+		FileData *file = new FileData();
+		if (!OpenPng(je, assetManager, path, file)) {
+			delete file;
+			return false;
+		}
+
+		// The canvas closes the file once it is decoded.
+        const char *cb = je->GetStringUTFChars(callbackID, 0);
+        theCanvas->QueuePngTexture(file, id, cb);
+        je->ReleaseStringUTFChars(callbackID, cb);
+		return true;
+    }
+	return false;
+}
+
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setTextureAtlas
+  (JNIEnv *je, jclass jc, jboolean enabled)
+{
+    Canvas *theCanvas = Canvas::GetCanvas();
+    if (theCanvas) {
+        theCanvas->SetTextureAtlas(enabled);
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setViewportCulling
+  (JNIEnv *je, jclass jc, jboolean enabled)
+{
+    Canvas *theCanvas = Canvas::GetCanvas();
+    if (theCanvas) {
+        theCanvas->SetViewportCulling(enabled);
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setBatchReordering
+  (JNIEnv *je, jclass jc, jboolean enabled)
+{
+    Canvas *theCanvas = Canvas::GetCanvas();
+    if (theCanvas) {
+        theCanvas->SetBatchReordering(enabled);
+    }
+}
+
 JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_removeTexture
   (JNIEnv *je, jclass jc, jint id)
 {
@@ -106,7 +158,25 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_render
         theCanvas->Render(rc, length);
         je->ReleaseStringUTFChars(renderCommands, rc);
 		
-		//send all callbacks, for now only capture callbacks
+		//send all callbacks: captures and queued texture loads
+		ExecuteCallbacks(je);
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_renderBinary
+  (JNIEnv *je, jclass jc, jobject renderCommands, jint length)
+{
+    Canvas *theCanvas = Canvas::GetCanvas();
+    if (theCanvas) {
+        // Direct buffers are read in place, no copy across the JNI boundary.
+        const unsigned char *rc = (const unsigned char *)je->GetDirectBufferAddress(renderCommands);
+        if (rc == NULL) return;
+        jlong capacity = je->GetDirectBufferCapacity(renderCommands);
+        if (length > capacity) length = (jint)capacity;
+
+        theCanvas->RenderBinary(rc, length);
+
+		//send all callbacks: captures and queued texture loads
 		ExecuteCallbacks(je);
     }
 }
@@ -121,13 +191,14 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_surfaceChanged
 }
 
 JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_captureGLLayer
-  (JNIEnv *je, jclass jc, jstring callbackID, jint x, jint y, jint w, jint h, jstring fileName) 
+  (JNIEnv *je, jclass jc, jstring callbackID, jint x, jint y, jint w, jint h, jstring fileName, jint compression,
+   jint output, jint thumbWidth, jint thumbHeight) 
 {
 	Canvas *theCanvas = Canvas::GetCanvas();
     if (theCanvas) {
 		const char *callback = je->GetStringUTFChars(callbackID, 0);
 		const char *fn = je->GetStringUTFChars(fileName, 0);
-		theCanvas->QueueCaptureGLLayer(x,y,w,h,callback,fn);
+		theCanvas->QueueCaptureGLLayer(x,y,w,h,callback,fn,compression,output,thumbWidth,thumbHeight);
 		//release memory for callbackString, might not want to do this here
 		je->ReleaseStringUTFChars(callbackID, callback);
 		je->ReleaseStringUTFChars(fileName, fn);
@@ -39,6 +39,38 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_addTexture
 JNIEXPORT jboolean JNICALL Java_com_adobe_plugins_FastCanvasJNI_addPngTexture
   (JNIEnv *, jclass, jobject, jstring, jint, jobject);
 
+/*
+ * Class:     com_adobe_plugins_FastCanvasJNI
+ * Method:    queuePngTexture
+ * Signature: (Ljava/lang/Object;Ljava/lang/String;ILjava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_adobe_plugins_FastCanvasJNI_queuePngTexture
+  (JNIEnv *, jclass, jobject, jstring, jint, jstring);
+
+/*
+ * Class:     com_adobe_plugins_FastCanvasJNI
+ * Method:    setTextureAtlas
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setTextureAtlas
+  (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     com_adobe_plugins_FastCanvasJNI
+ * Method:    setViewportCulling
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setViewportCulling
+  (JNIEnv *, jclass, jboolean);
+
+/*
+ * Class:     com_adobe_plugins_FastCanvasJNI
+ * Method:    setBatchReordering
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_setBatchReordering
+  (JNIEnv *, jclass, jboolean);
+
 /*
  * Class:     com_adobe_plugins_FastCanvasJNI
  * Method:    removeTexture
@@ -55,6 +87,14 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_removeTexture
 JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_render
   (JNIEnv *, jclass, jstring);
 
+/*
+ * Class:     com_adobe_plugins_FastCanvasJNI
+ * Method:    renderBinary
+ * Signature: (Ljava/nio/ByteBuffer;I)V
+ */
+JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_renderBinary
+  (JNIEnv *, jclass, jobject, jint);
+
 /*
  * Class:     com_adobe_plugins_FastCanvasJNI
  * Method:    surfaceChanged
@@ -66,10 +106,10 @@ JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_surfaceChanged
 /*
  * Class:     com_adobe_plugins_FastCanvasJNI
  * Method:    captureGLLayer
- * Signature: (Ljava/lang/String;IIIILjava/lang/String;)V
+ * Signature: (Ljava/lang/String;IIIILjava/lang/String;IIII)V
  */
 JNIEXPORT void JNICALL Java_com_adobe_plugins_FastCanvasJNI_captureGLLayer
-  (JNIEnv *, jclass, jstring, jint, jint, jint, jint, jstring);
+  (JNIEnv *, jclass, jstring, jint, jint, jint, jint, jstring, jint, jint, jint, jint);
 
 /*
  * Class:     com_adobe_plugins_FastCanvasJNI
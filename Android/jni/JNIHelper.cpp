@@ -26,7 +26,7 @@ void ExecuteCallbacks(JNIEnv * je) {
 		   return;
 		}
 
-		jmethodID mid = je->GetStaticMethodID(cls, "executeCallback", "(Ljava/lang/String;ZLjava/lang/String;)V");
+		jmethodID mid = je->GetStaticMethodID(cls, "executeCallback", "(Ljava/lang/String;ZLjava/lang/String;[B)V");
 		if (je->ExceptionCheck()) {
 		   return;
 		}
@@ -34,7 +34,25 @@ void ExecuteCallbacks(JNIEnv * je) {
 		while(callback) {
 			jstring methodID = je->NewStringUTF(callback->callbackID);
 			jstring result = je->NewStringUTF(callback->result);
-			je->CallStaticVoidMethod( cls, mid, methodID, callback->isError, result);
+			jbyteArray data = NULL;
+			if(callback->data) {
+				data = je->NewByteArray(callback->dataSize);
+				if(data) {
+					je->SetByteArrayRegion(data, 0, callback->dataSize, (const jbyte *)callback->data);
+				} else {
+					//out of memory; answer with an error instead of the bytes
+					je->ExceptionClear();
+					je->DeleteLocalRef(result);
+					result = je->NewStringUTF("Unable to allocate buffer");
+					callback->isError = true;
+				}
+			}
+			je->CallStaticVoidMethod( cls, mid, methodID, callback->isError, result, data);
+			je->DeleteLocalRef(methodID);
+			je->DeleteLocalRef(result);
+			if(data) {
+				je->DeleteLocalRef(data);
+			}
 			//delete the callback we just sent
 			theCanvas->PopCallbacks();
 			//get the next callback
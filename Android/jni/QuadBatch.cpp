@@ -0,0 +1,246 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Canvas.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#   define USE_NEON_QUADS
+#   include <arm_neon.h>
+#elif defined(__SSE2__)
+#   define USE_SSE2_QUADS
+#   include <emmintrin.h>
+#endif
+
+void QuadBatch::Add( const Transform &transform, const Clip &clip, const Texture *texture,
+                     const Color &color, int firstVertex )
+{
+    int n = m_transforms.GetSize();
+    if ( n == 0 || memcmp( &m_transforms[n-1], &transform, sizeof(Transform) ) != 0 ) {
+        m_transforms.Append( &transform, 1 );
+        n++;
+    }
+    int transformIndex = n-1;
+
+    float x0 = clip.px;
+    float y0 = clip.py;
+    float x1 = clip.px+clip.pw;
+    float y1 = clip.py+clip.ph;
+
+    // Texture, offset to where it sits within the GL texture
+    float cx = clip.cx + (float)texture->GetX();
+    float cy = clip.cy + (float)texture->GetY();
+    float u0 = cx           * texture->GetInvGlWidth();
+    float v0 = cy           * texture->GetInvGlHeight();
+    float u1 = (cx+clip.cw) * texture->GetInvGlWidth();
+    float v1 = (cy+clip.ch) * texture->GetInvGlHeight();
+
+    m_x0.Append( &x0, 1 );
+    m_y0.Append( &y0, 1 );
+    m_x1.Append( &x1, 1 );
+    m_y1.Append( &y1, 1 );
+    m_u0.Append( &u0, 1 );
+    m_v0.Append( &v0, 1 );
+    m_u1.Append( &u1, 1 );
+    m_v1.Append( &v1, 1 );
+    m_color.Append( &color, 1 );
+    m_transformIndex.Append( &transformIndex, 1 );
+    m_firstVertex.Append( &firstVertex, 1 );
+}
+
+// Writes quad i from its corner positions, which go clockwise from
+// (x0, y0).
+void QuadBatch::WriteQuad( int i, const float *x, const float *y, Vertex2 *vertices ) const
+{
+    Vertex2 *v = vertices + m_firstVertex[i];
+    const float u[4] = { m_u0[i], m_u1[i], m_u1[i], m_u0[i] };
+    const float t[4] = { m_v0[i], m_v0[i], m_v1[i], m_v1[i] };
+    for ( int k = 0; k < 4; k++) {
+        v[k].pos.x = x[k];
+        v[k].pos.y = y[k];
+        v[k].tex.x = u[k];
+        v[k].tex.y = t[k];
+        v[k].color = m_color[i];
+    }
+#ifndef USE_INDEX_BUFFER
+    v[4] = v[0];
+    v[5] = v[2];
+#endif
+}
+
+// One quad, skipping the arithmetic its transform doesn't need. Each
+// case computes the same values as the general one, minus the terms
+// that are 0.
+void QuadBatch::ExpandScalar( int i, Vertex2 *vertices ) const
+{
+    const Transform &transform = m_transforms[m_transformIndex[i]];
+    float x0 = m_x0[i];
+    float y0 = m_y0[i];
+    float x1 = m_x1[i];
+    float y1 = m_y1[i];
+    float x[4], y[4];
+
+    switch ( transform.kind ) {
+    case Transform::kIdentity:
+        x0 = floor(x0);
+        y0 = floor(y0);
+        x1 = floor(x1);
+        y1 = floor(y1);
+        break;
+    case Transform::kTranslate:
+        x0 = floor(x0 + transform.tx);
+        y0 = floor(y0 + transform.ty);
+        x1 = floor(x1 + transform.tx);
+        y1 = floor(y1 + transform.ty);
+        break;
+    case Transform::kScale:
+        x0 = floor(transform.a*x0 + transform.tx);
+        y0 = floor(transform.d*y0 + transform.ty);
+        x1 = floor(transform.a*x1 + transform.tx);
+        y1 = floor(transform.d*y1 + transform.ty);
+        break;
+    default: {
+        float ax0 = transform.a*x0, ax1 = transform.a*x1;
+        float bx0 = transform.b*x0, bx1 = transform.b*x1;
+        float cy0 = transform.c*y0, cy1 = transform.c*y1;
+        float dy0 = transform.d*y0, dy1 = transform.d*y1;
+
+        x[0] = floor(ax0 + cy0 + transform.tx);
+        y[0] = floor(bx0 + dy0 + transform.ty);
+        x[1] = floor(ax1 + cy0 + transform.tx);
+        y[1] = floor(bx1 + dy0 + transform.ty);
+        x[2] = floor(ax1 + cy1 + transform.tx);
+        y[2] = floor(bx1 + dy1 + transform.ty);
+        x[3] = floor(ax0 + cy1 + transform.tx);
+        y[3] = floor(bx0 + dy1 + transform.ty);
+        WriteQuad( i, x, y, vertices );
+    }
+    return;
+    }
+
+    // Axis aligned: the corners share their edges.
+    x[0] = x0;
+    y[0] = y0;
+    x[1] = x1;
+    y[1] = y0;
+    x[2] = x1;
+    y[2] = y1;
+    x[3] = x0;
+    y[3] = y1;
+    WriteQuad( i, x, y, vertices );
+}
+
+// The vector kernels use the general transform for four quads at once,
+// so corner k of quad j is lane j of corner vector k. floor is truncate
+// and adjust; values of 2^23 and up are already whole and may not fit
+// in an int, so they pass through.
+#if defined(USE_SSE2_QUADS)
+
+static inline __m128 Floor4( __m128 x )
+{
+    const __m128 one = _mm_set1_ps( 1.0f );
+    const __m128 whole = _mm_set1_ps( 8388608.0f );
+    const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+    __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( x ));
+    t = _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, x ), one ));
+    __m128 big = _mm_cmpge_ps( _mm_and_ps( x, absMask ), whole );
+    return _mm_or_ps( _mm_and_ps( big, x ), _mm_andnot_ps( big, t ));
+}
+
+static inline void Corner4( __m128 a, __m128 c, __m128 tx, __m128 px, __m128 py, float *out )
+{
+    _mm_storeu_ps( out, Floor4( _mm_add_ps( _mm_add_ps( _mm_mul_ps( a, px ), _mm_mul_ps( c, py )), tx )));
+}
+
+#define LOAD4(p)    _mm_loadu_ps(p)
+#define CORNER4     Corner4
+
+#elif defined(USE_NEON_QUADS)
+
+static inline float32x4_t Floor4( float32x4_t x )
+{
+    const float32x4_t one = vdupq_n_f32( 1.0f );
+    const float32x4_t whole = vdupq_n_f32( 8388608.0f );
+    float32x4_t t = vcvtq_f32_s32( vcvtq_s32_f32( x ));
+    uint32x4_t gt = vcgtq_f32( t, x );
+    t = vsubq_f32( t, vreinterpretq_f32_u32( vandq_u32( gt, vreinterpretq_u32_f32( one ))));
+    return vbslq_f32( vcageq_f32( x, whole ), x, t );
+}
+
+// Multiply and add separately, rather than vmla, to round like the
+// scalar path.
+static inline void Corner4( float32x4_t a, float32x4_t c, float32x4_t tx, float32x4_t px, float32x4_t py, float *out )
+{
+    vst1q_f32( out, Floor4( vaddq_f32( vaddq_f32( vmulq_f32( a, px ), vmulq_f32( c, py )), tx )));
+}
+
+#define LOAD4(p)    vld1q_f32(p)
+#define CORNER4     Corner4
+
+#endif
+
+void QuadBatch::Expand( Vertex2 *vertices )
+{
+    const int size = GetSize();
+    int i = 0;
+
+#ifdef CORNER4
+    for ( ; i+4 <= size; i += 4) {
+        // Gather the transforms into lanes.
+        float a[4], b[4], c[4], d[4], tx[4], ty[4];
+        for ( int j = 0; j < 4; j++) {
+            const Transform &t = m_transforms[m_transformIndex[i+j]];
+            a[j] = t.a;
+            b[j] = t.b;
+            c[j] = t.c;
+            d[j] = t.d;
+            tx[j] = t.tx;
+            ty[j] = t.ty;
+        }
+        float x[4][4], y[4][4];     // [corner][quad]
+        CORNER4( LOAD4(a), LOAD4(c), LOAD4(tx), LOAD4(&m_x0[i]), LOAD4(&m_y0[i]), x[0] );
+        CORNER4( LOAD4(b), LOAD4(d), LOAD4(ty), LOAD4(&m_x0[i]), LOAD4(&m_y0[i]), y[0] );
+        CORNER4( LOAD4(a), LOAD4(c), LOAD4(tx), LOAD4(&m_x1[i]), LOAD4(&m_y0[i]), x[1] );
+        CORNER4( LOAD4(b), LOAD4(d), LOAD4(ty), LOAD4(&m_x1[i]), LOAD4(&m_y0[i]), y[1] );
+        CORNER4( LOAD4(a), LOAD4(c), LOAD4(tx), LOAD4(&m_x1[i]), LOAD4(&m_y1[i]), x[2] );
+        CORNER4( LOAD4(b), LOAD4(d), LOAD4(ty), LOAD4(&m_x1[i]), LOAD4(&m_y1[i]), y[2] );
+        CORNER4( LOAD4(a), LOAD4(c), LOAD4(tx), LOAD4(&m_x0[i]), LOAD4(&m_y1[i]), x[3] );
+        CORNER4( LOAD4(b), LOAD4(d), LOAD4(ty), LOAD4(&m_x0[i]), LOAD4(&m_y1[i]), y[3] );
+
+        for ( int j = 0; j < 4; j++) {
+            const float qx[4] = { x[0][j], x[1][j], x[2][j], x[3][j] };
+            const float qy[4] = { y[0][j], y[1][j], y[2][j], y[3][j] };
+            WriteQuad( i+j, qx, qy, vertices );
+        }
+    }
+#endif
+    for ( ; i < size; i++) {
+        ExpandScalar( i, vertices );
+    }
+
+    m_x0.SetSize(0);
+    m_y0.SetSize(0);
+    m_x1.SetSize(0);
+    m_y1.SetSize(0);
+    m_u0.SetSize(0);
+    m_v0.SetSize(0);
+    m_u1.SetSize(0);
+    m_v1.SetSize(0);
+    m_color.SetSize(0);
+    m_transformIndex.SetSize(0);
+    m_firstVertex.SetSize(0);
+    m_transforms.SetSize(0);
+}
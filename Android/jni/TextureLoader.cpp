@@ -0,0 +1,394 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "Canvas.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#endif
+extern "C" {
+#include "lodepng.h"
+}
+
+FileData::FileData()
+{
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = NULL;
+    m_allocated = NULL;
+#if defined(__ANDROID__)
+    m_asset = NULL;
+#endif
+}
+
+FileData::~FileData()
+{
+    Close();
+}
+
+#if defined(__ANDROID__)
+bool FileData::OpenAsset( AAssetManager *mgr, const char *path )
+{
+    Close();
+    m_asset = AAssetManager_open( mgr, path, AASSET_MODE_BUFFER );
+    if (!m_asset) {
+        return false;
+    }
+
+    m_size = AAsset_getLength( m_asset );
+    m_data = (const unsigned char *)AAsset_getBuffer( m_asset );
+    if (m_data) {
+        return true;
+    }
+
+    // The asset manager couldn't map or inflate it; read it instead.
+    m_allocated = (unsigned char *)malloc( m_size > 0 ? m_size : 1 );
+    if (!m_allocated || AAsset_read( m_asset, m_allocated, m_size ) != m_size) {
+        Close();
+        return false;
+    }
+    m_data = m_allocated;
+    return true;
+}
+#endif
+
+bool FileData::OpenFile( const char *path )
+{
+    Close();
+    int fd = open( path, O_RDONLY );
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat( fd, &info ) == 0 && info.st_size > 0) {
+        void *mapped = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if (mapped != MAP_FAILED) {
+            m_mapped = mapped;
+            m_data = (const unsigned char *)mapped;
+            m_size = (long)info.st_size;
+        }
+    }
+    // The mapping stays valid without the descriptor.
+    close( fd );
+    return m_data != NULL;
+}
+
+void FileData::Close()
+{
+    if (m_mapped) {
+        munmap( m_mapped, (size_t)m_size );
+    }
+    if (m_allocated) {
+        free( m_allocated );
+    }
+#if defined(__ANDROID__)
+    if (m_asset) {
+        AAsset_close( m_asset );
+    }
+    m_asset = NULL;
+#endif
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = NULL;
+    m_allocated = NULL;
+}
+
+//---------------------------------------------------------------
+
+StagingBuffer::StagingBuffer()
+{
+    m_pixels = NULL;
+    m_capacity = 0;
+    m_width = 0;
+    m_height = 0;
+    m_paddedWidth = 0;
+    m_paddedHeight = 0;
+}
+
+StagingBuffer::~StagingBuffer()
+{
+    if (m_pixels) {
+        free(m_pixels);
+    }
+}
+
+unsigned StagingBuffer::DecodePng( const unsigned char *png, long size )
+{
+    unsigned int width, height;
+    LodePNGState state;
+    lodepng_state_init( &state );
+    unsigned error = lodepng_inspect( &width, &height, &state, png, (size_t)size );
+    lodepng_state_cleanup( &state );
+    if (error) {
+        return error;
+    }
+
+    unsigned int paddedWidth = 2;
+    while (paddedWidth < width) {
+        paddedWidth *= 2;
+    }
+    unsigned int paddedHeight = 2;
+    while (paddedHeight < height) {
+        paddedHeight *= 2;
+    }
+
+    size_t stride = (size_t)paddedWidth * 4;
+    size_t needed = stride * paddedHeight;
+    if (needed > m_capacity) {
+        // Nothing in the old contents is worth a realloc copy.
+        free( m_pixels );
+        m_pixels = (unsigned char *)malloc( needed );
+        m_capacity = m_pixels ? needed : 0;
+        if (!m_pixels) {
+            return 83; // lodepng's "memory allocation failed"
+        }
+    }
+
+    error = lodepng_decode32_into( m_pixels, needed, stride, &width, &height, png, (size_t)size );
+    if (error) {
+        return error;
+    }
+
+    // Clear the padding, which linear filtering at the image's
+    // right and bottom edges can sample.
+    size_t rowBytes = (size_t)width * 4;
+    if (rowBytes < stride) {
+        for (unsigned int y = 0; y < height; y++) {
+            memset( m_pixels + stride * y + rowBytes, 0, stride - rowBytes );
+        }
+    }
+    memset( m_pixels + stride * height, 0, stride * (paddedHeight - height) );
+
+    m_width = width;
+    m_height = height;
+    m_paddedWidth = paddedWidth;
+    m_paddedHeight = paddedHeight;
+    return 0;
+}
+
+void StagingBuffer::Trim()
+{
+    if (m_capacity > kKeepBytes) {
+        free( m_pixels );
+        m_pixels = NULL;
+        m_capacity = 0;
+    }
+}
+
+//---------------------------------------------------------------
+
+TextureLoad::TextureLoad(int textureID, FileData *file, const char * callback)
+{
+    id = textureID;
+    png = file;
+    staging = NULL;
+    error = 0;
+    cancelled = false;
+    strncpy( callbackID, callback ? callback : "", ALLOCATED-1 );
+    callbackID[ALLOCATED-1] = 0;
+}
+
+TextureLoad::~TextureLoad()
+{
+    delete png;
+    delete staging;
+}
+
+//---------------------------------------------------------------
+
+TextureLoader::TextureLoader()
+{
+    m_numThreads = 0;
+    m_quit = false;
+    pthread_mutex_init( &m_mutex, NULL );
+    pthread_cond_init( &m_wake, NULL );
+}
+
+TextureLoader::~TextureLoader()
+{
+    pthread_mutex_lock( &m_mutex );
+    m_quit = true;
+    pthread_cond_broadcast( &m_wake );
+    pthread_mutex_unlock( &m_mutex );
+
+    // A worker in the middle of a decode finishes it first.
+    for (int i = 0; i < m_numThreads; i++) {
+        pthread_join( m_threads[i], NULL );
+    }
+
+    for (int i = 0; i < m_pending.GetSize(); i++) {
+        delete m_pending[i];
+    }
+    for (int i = 0; i < m_decoded.GetSize(); i++) {
+        delete m_decoded[i];
+    }
+    for (int i = 0; i < m_spare.GetSize(); i++) {
+        delete m_spare[i];
+    }
+    pthread_cond_destroy( &m_wake );
+    pthread_mutex_destroy( &m_mutex );
+}
+
+// One worker per core beyond the one running the GL thread.
+void TextureLoader::StartThreads()
+{
+    long cores = sysconf( _SC_NPROCESSORS_ONLN );
+    int count = (int)cores - 1;
+    if (count < 1) count = 1;
+    if (count > kMaxThreads) count = kMaxThreads;
+
+    for (int i = 0; i < count; i++) {
+        if (pthread_create( &m_threads[m_numThreads], NULL, ThreadMain, this ) == 0) {
+            m_numThreads++;
+        }
+    }
+}
+
+void TextureLoader::Queue( TextureLoad *load )
+{
+    pthread_mutex_lock( &m_mutex );
+    if (m_numThreads == 0) {
+        StartThreads();
+    }
+    if (m_numThreads == 0) {
+        // Without a worker the load would never finish; decode it here.
+        pthread_mutex_unlock( &m_mutex );
+        Decode( load );
+        pthread_mutex_lock( &m_mutex );
+        m_decoded.Append( &load, 1 );
+    } else {
+        m_pending.Append( &load, 1 );
+        pthread_cond_signal( &m_wake );
+    }
+    pthread_mutex_unlock( &m_mutex );
+}
+
+TextureLoad *TextureLoader::TakeDecoded()
+{
+    TextureLoad *load = NULL;
+    pthread_mutex_lock( &m_mutex );
+    if (!m_decoded.IsEmpty()) {
+        load = m_decoded[0];
+        m_decoded.RemoveAt(0);
+    }
+    pthread_mutex_unlock( &m_mutex );
+    return load;
+}
+
+void TextureLoader::Cancel( int id )
+{
+    pthread_mutex_lock( &m_mutex );
+    for (int i = m_pending.GetSize()-1; i >= 0; i--) {
+        if (m_pending[i]->id == id) {
+            delete m_pending[i];
+            m_pending.RemoveAt(i);
+        }
+    }
+    // The worker deletes these once it is done with them.
+    for (int i = 0; i < m_decoding.GetSize(); i++) {
+        if (m_decoding[i]->id == id) {
+            m_decoding[i]->cancelled = true;
+        }
+    }
+    for (int i = m_decoded.GetSize()-1; i >= 0; i--) {
+        if (m_decoded[i]->id == id) {
+            delete m_decoded[i];
+            m_decoded.RemoveAt(i);
+        }
+    }
+    pthread_mutex_unlock( &m_mutex );
+}
+
+void TextureLoader::Recycle( TextureLoad *load )
+{
+    StagingBuffer *staging = load->staging;
+    load->staging = NULL;
+    delete load;
+    if (!staging) {
+        return;
+    }
+
+    staging->Trim();
+    pthread_mutex_lock( &m_mutex );
+    if (m_spare.GetSize() < kMaxThreads) {
+        m_spare.Append( &staging, 1 );
+        staging = NULL;
+    }
+    pthread_mutex_unlock( &m_mutex );
+    delete staging;
+}
+
+// Called without m_mutex held.
+void TextureLoader::Decode( TextureLoad *load )
+{
+    pthread_mutex_lock( &m_mutex );
+    if (!m_spare.IsEmpty()) {
+        load->staging = m_spare[m_spare.GetSize()-1];
+        m_spare.RemoveAt( m_spare.GetSize()-1 );
+    }
+    pthread_mutex_unlock( &m_mutex );
+
+    if (!load->staging) {
+        load->staging = new StagingBuffer();
+    }
+    load->error = load->staging->DecodePng( load->png->GetData(), load->png->GetSize() );
+    delete load->png;
+    load->png = NULL;
+}
+
+/*static*/
+void *TextureLoader::ThreadMain( void *arg )
+{
+    ((TextureLoader *)arg)->Run();
+    return NULL;
+}
+
+void TextureLoader::Run()
+{
+    pthread_mutex_lock( &m_mutex );
+    for (;;) {
+        while (!m_quit && m_pending.IsEmpty()) {
+            pthread_cond_wait( &m_wake, &m_mutex );
+        }
+        if (m_quit) {
+            break;
+        }
+
+        TextureLoad *load = m_pending[0];
+        m_pending.RemoveAt(0);
+        m_decoding.Append( &load, 1 );
+        pthread_mutex_unlock( &m_mutex );
+
+        Decode( load );
+
+        pthread_mutex_lock( &m_mutex );
+        for (int i = 0; i < m_decoding.GetSize(); i++) {
+            if (m_decoding[i] == load) {
+                m_decoding.RemoveAt(i);
+                break;
+            }
+        }
+        if (load->cancelled || m_quit) {
+            delete load;
+        } else {
+            m_decoded.Append( &load, 1 );
+        }
+    }
+    pthread_mutex_unlock( &m_mutex );
+}
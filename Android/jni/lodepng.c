@@ -37,6 +37,10 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <fstream>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+#ifdef LODEPNG_COMPILE_SIMD_UNFILTER
+#include "lodepng_unfilter.h"
+#endif /*LODEPNG_COMPILE_SIMD_UNFILTER*/
+
 #define VERSION_STRING "20130415"
 
 /*
@@ -327,7 +331,7 @@ static void string_set(char** out, const char* in)
 
 unsigned lodepng_read32bitInt(const unsigned char* buffer)
 {
-  return (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+  return ((unsigned)buffer[0] << 24) | ((unsigned)buffer[1] << 16) | ((unsigned)buffer[2] << 8) | buffer[3];
 }
 
 #if defined(LODEPNG_COMPILE_PNG) || defined(LODEPNG_COMPILE_ENCODER)
@@ -499,6 +503,8 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  unsigned* table; /*lookup table for the decoder, see HuffmanTree_makeTable*/
+  unsigned tablesubbits; /*bits indexing each second level table*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -519,6 +525,7 @@ static void HuffmanTree_init(HuffmanTree* tree)
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -526,6 +533,7 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -944,6 +952,111 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
     if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
   }
 }
+
+/*
+Lookup tables for decoding a symbol from several bits at once. The root table
+is indexed by the next HUFFMAN_ROOT_BITS bits of input (first bit in the least
+significant position). Codes longer than that have an entry pointing to a
+second level table, indexed by the tablesubbits bits after those. Each entry
+holds the symbol and the number of bits it used, or a flag. The entries are
+made by walking tree2d the way huffmanDecodeSymbol does. tablesubbits comes
+from the longest code, but in an invalid tree a code can end on an existing
+node, and paths through it run deeper than that. Their entries are flagged
+HUFFMAN_SLOW, and those symbols are left to huffmanDecodeSymbol.
+*/
+#define HUFFMAN_ROOT_BITS 9
+#define HUFFMAN_SUBTABLE 0x1000000u /*value is the offset of the second level table*/
+#define HUFFMAN_INVALID 0x2000000u /*the bits lead outside the tree*/
+#define HUFFMAN_SLOW 0x4000000u /*the path is longer than the table reaches*/
+
+/*
+walks tree2d from treepos with up to nbits bits. returns 0 with the symbol and
+bits used, 1 with the node reached if the bits ran out first, 2 if the walk
+went outside the tree
+*/
+static unsigned huffmanWalk(const HuffmanTree* tree, unsigned treepos, unsigned bits, unsigned nbits,
+                            unsigned* value, unsigned* used)
+{
+  unsigned i, ct;
+  for(i = 0; i < nbits; i++)
+  {
+    ct = tree->tree2d[(treepos << 1) + ((bits >> i) & 1)];
+    if(ct < tree->numcodes)
+    {
+      *value = ct;
+      *used = i + 1;
+      return 0;
+    }
+    treepos = ct - tree->numcodes;
+    if(treepos >= tree->numcodes) return 2;
+  }
+  *value = treepos;
+  return 1;
+}
+
+/*return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  unsigned i, j, value, used, maxlen = 0, numsub = 0, subsize, offset;
+  const unsigned rootsize = 1u << HUFFMAN_ROOT_BITS;
+
+  if(!tree->tree2d) return 83; /*alloc fail while making the tree*/
+
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    if(tree->lengths[i] > maxlen) maxlen = tree->lengths[i];
+  }
+  tree->tablesubbits = maxlen > HUFFMAN_ROOT_BITS ? maxlen - HUFFMAN_ROOT_BITS : 0;
+  subsize = 1u << tree->tablesubbits;
+
+  /*every root entry whose walk outlasts the root bits gets a second level table, if there are any*/
+  if(tree->tablesubbits)
+  {
+    for(i = 0; i < rootsize; i++)
+    {
+      if(huffmanWalk(tree, 0, i, HUFFMAN_ROOT_BITS, &value, &used) == 1) numsub++;
+    }
+  }
+
+  tree->table = (unsigned*)lodepng_malloc((rootsize + numsub * subsize) * sizeof(unsigned));
+  if(!tree->table) return 83; /*alloc fail*/
+
+  offset = rootsize;
+  for(i = 0; i < rootsize; i++)
+  {
+    unsigned result = huffmanWalk(tree, 0, i, HUFFMAN_ROOT_BITS, &value, &used);
+    if(result == 0) tree->table[i] = value | (used << 16);
+    else if(result == 2) tree->table[i] = HUFFMAN_INVALID;
+    else if(!tree->tablesubbits) tree->table[i] = HUFFMAN_SLOW; /*only an invalid tree goes deeper*/
+    else
+    {
+      /*value is the node the root bits led to*/
+      for(j = 0; j < subsize; j++)
+      {
+        unsigned subvalue;
+        result = huffmanWalk(tree, value, j, tree->tablesubbits, &subvalue, &used);
+        if(result == 0) tree->table[offset + j] = subvalue | ((HUFFMAN_ROOT_BITS + used) << 16);
+        else if(result == 2) tree->table[offset + j] = HUFFMAN_INVALID;
+        else tree->table[offset + j] = HUFFMAN_SLOW;
+      }
+      tree->table[i] = HUFFMAN_SUBTABLE | offset;
+      offset += subsize;
+    }
+  }
+
+  return 0;
+}
+
+/*returns the table entry for the symbol at the start of bits*/
+static unsigned huffmanTableLookup(const HuffmanTree* tree, unsigned bits)
+{
+  unsigned entry = tree->table[bits & ((1u << HUFFMAN_ROOT_BITS) - 1)];
+  if(entry & HUFFMAN_SUBTABLE)
+  {
+    entry = tree->table[(entry & 0xffff) + ((bits >> HUFFMAN_ROOT_BITS) & ((1u << tree->tablesubbits) - 1))];
+  }
+  return entry;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -993,6 +1106,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     bitlen_cl = (unsigned*)lodepng_malloc(NUM_CODE_LENGTH_CODES * sizeof(unsigned));
     if(!bitlen_cl) ERROR_BREAK(83 /*alloc fail*/);
+    if((*bp) + HCLEN * 3 > inbitlength) ERROR_BREAK(50); /*error: the bit pointer is or will go past the memory*/
 
     for(i = 0; i < NUM_CODE_LENGTH_CODES; i++)
     {
@@ -1026,7 +1140,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         unsigned replength = 3; /*read in the 2 bits that indicate repeat length (3-6)*/
         unsigned value; /*set value to the previous code*/
 
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(*bp + 2 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
         if (i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
         replength += readBitsFromStream(bp, in, 2);
@@ -1045,7 +1159,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(*bp + 3 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
         replength += readBitsFromStream(bp, in, 3);
 
@@ -1062,7 +1176,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        if(*bp + 7 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
         replength += readBitsFromStream(bp, in, 7);
 
@@ -1108,6 +1222,114 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*the next 57 or more bits from bp, the first in the least significant bit. Reads 8 bytes.*/
+static unsigned long long readBits64(const unsigned char* in, size_t bp)
+{
+  const unsigned char* p = &in[bp >> 3];
+  unsigned long long result = (unsigned long long)p[0]
+                            | ((unsigned long long)p[1] << 8)
+                            | ((unsigned long long)p[2] << 16)
+                            | ((unsigned long long)p[3] << 24)
+                            | ((unsigned long long)p[4] << 32)
+                            | ((unsigned long long)p[5] << 40)
+                            | ((unsigned long long)p[6] << 48)
+                            | ((unsigned long long)p[7] << 56);
+  return result >> (bp & 0x7);
+}
+
+/*
+Decodes symbols of a block with the lookup tables while at least 8 bytes of
+input are left. One readBits64 then covers a whole literal or length/distance
+pair: at most 15 + 5 + 15 + 13 bits. Gives the same output and errors as the
+bit by bit loop in inflateHuffmanBlock, which decodes whatever is left of the
+block, including everything from a HUFFMAN_SLOW symbol on. Sets *done if the
+end code was reached.
+Compared with lodepng before the tables, streams that decode give the same
+bytes, but corrupt ones can fail with a different error code, because the
+code length and extra bits reads are bounds checked more strictly.
+*/
+static unsigned inflateHuffmanFast(ucvector* out, const unsigned char* in, size_t* bp,
+                                   size_t* pos, size_t inlength,
+                                   const HuffmanTree* tree_ll, const HuffmanTree* tree_d, int* done)
+{
+  while(((*bp) >> 3) + 8 <= inlength)
+  {
+    size_t start = *bp;
+    unsigned long long bits = readBits64(in, *bp);
+    unsigned entry = huffmanTableLookup(tree_ll, (unsigned)bits);
+    unsigned code_ll, used;
+
+    if(entry & HUFFMAN_INVALID) return 11; /*error: wrong jump outside of tree*/
+    if(entry & HUFFMAN_SLOW) return 0;
+    code_ll = entry & 0xffff;
+    used = (entry >> 16) & 0xff;
+    bits >>= used;
+    (*bp) += used;
+
+    if(code_ll <= 255) /*literal symbol*/
+    {
+      if((*pos) >= out->size)
+      {
+        /*reserve more room at once*/
+        if(!ucvector_resize(out, ((*pos) + 1) * 2)) return 83; /*alloc fail*/
+      }
+      out->data[(*pos)] = (unsigned char)(code_ll);
+      (*pos)++;
+    }
+    else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/
+    {
+      unsigned code_d, distance, numextrabits;
+      size_t length;
+      unsigned char* dest;
+      const unsigned char* src;
+
+      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      numextrabits = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
+      length += (unsigned)bits & ((1u << numextrabits) - 1);
+      bits >>= numextrabits;
+      (*bp) += numextrabits;
+
+      entry = huffmanTableLookup(tree_d, (unsigned)bits);
+      if(entry & HUFFMAN_INVALID) return 18; /*error: invalid distance code*/
+      if(entry & HUFFMAN_SLOW)
+      {
+        *bp = start; /*the bit by bit loop decodes the pair again*/
+        return 0;
+      }
+      code_d = entry & 0xffff;
+      if(code_d > 29) return 18; /*error: invalid distance code (30-31 are never used)*/
+      used = (entry >> 16) & 0xff;
+      bits >>= used;
+      (*bp) += used;
+
+      distance = DISTANCEBASE[code_d];
+      numextrabits = DISTANCEEXTRA[code_d];
+      distance += (unsigned)bits & ((1u << numextrabits) - 1);
+      (*bp) += numextrabits;
+
+      if(distance > (*pos)) return 52; /*too long backward distance*/
+      if((*pos) + length >= out->size)
+      {
+        /*reserve more room at once*/
+        if(!ucvector_resize(out, ((*pos) + length) * 2)) return 83; /*alloc fail*/
+      }
+
+      /*the source may overlap what is being written, which repeats it*/
+      dest = &out->data[(*pos)];
+      src = dest - distance;
+      (*pos) += length;
+      while(length--) *dest++ = *src++;
+    }
+    else if(code_ll == 256)
+    {
+      *done = 1; /*end code*/
+      return 0;
+    }
+    else return 11; /*error: unused code 286 or 287*/
+  }
+  return 0;
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
 static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
                                     size_t* pos, size_t inlength, unsigned btype)
@@ -1116,6 +1338,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
   size_t inbitlength = inlength * 8;
+  int done = 0;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
@@ -1123,7 +1346,11 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
   else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
 
-  while(!error) /*decode all symbols until end reached, breaks at end code*/
+  if(!error) error = HuffmanTree_makeTable(&tree_ll);
+  if(!error) error = HuffmanTree_makeTable(&tree_d);
+  if(!error) error = inflateHuffmanFast(out, in, bp, pos, inlength, &tree_ll, &tree_d, &done);
+
+  while(!error && !done) /*decode the rest of the symbols, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
     unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
@@ -1148,7 +1375,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(*bp >= inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      if(*bp + numextrabits_l > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
       length += readBitsFromStream(bp, in, numextrabits_l);
 
       /*part 3: get distance code*/
@@ -1168,7 +1395,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if(*bp >= inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      if(*bp + numextrabits_d > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
 
       distance += readBitsFromStream(bp, in, numextrabits_d);
 
@@ -1438,6 +1665,23 @@ static void updateHashChain(Hash* hash, size_t pos, int hashval, unsigned window
   hash->head[hashval] = wpos;
 }
 
+/*
+Adds in[start..end-1] to the hash chains without encoding anything, so that the
+LZ77 encoding of what follows can refer back to those bytes.
+*/
+static void addHashRange(Hash* hash, const unsigned char* in, size_t start, size_t end, size_t insize,
+                         unsigned windowsize)
+{
+  int usezeros = windowsize >= 8192; /*the same as in encodeLZ77*/
+  size_t pos;
+  for(pos = start; pos < end; pos++)
+  {
+    unsigned hashval = getHash(in, insize, pos);
+    updateHashChain(hash, pos, hashval, windowsize);
+    if(usezeros && hashval == 0) hash->zeros[pos % windowsize] = countZeros(in, insize, pos);
+  }
+}
+
 /*
 LZ77-encode the data. Return value is error code. The input are raw bytes, the output
 is in the form of unsigned integers with codes representing for example literal bytes, or
@@ -1449,13 +1693,13 @@ this hash technique is one out of several ways to speed this up.
 */
 static unsigned encodeLZ77(uivector* out, Hash* hash,
                            const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
-                           unsigned minmatch, unsigned nicematch, unsigned lazymatching)
+                           unsigned minmatch, unsigned nicematch, unsigned lazymatching, unsigned chainlimit)
 {
   unsigned short numzeros = 0;
   int usezeros = windowsize >= 8192; /*for small window size, the 'max chain length' optimization does a better job*/
   unsigned pos, i, error = 0;
   /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
-  unsigned maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
+  unsigned maxchainlength = chainlimit ? chainlimit : windowsize >= 8192 ? windowsize : windowsize / 8;
   unsigned maxlazymatch = windowsize >= 8192 ? MAX_SUPPORTED_DEFLATE_LENGTH : 64;
 
   if(!error)
@@ -1605,19 +1849,21 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, int final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
   size_t i, j, numdeflateblocks = (datasize + 65534) / 65535;
   unsigned datapos = 0;
+  /*empty input still needs its final block*/
+  if(numdeflateblocks == 0 && final) numdeflateblocks = 1;
   for(i = 0; i < numdeflateblocks; i++)
   {
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1738,7 +1984,8 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     if(settings->use_lz77)
     {
       error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+                         settings->minmatch, settings->nicematch, settings->lazymatching,
+                         settings->maxchainlength);
       if(error) break;
     }
     else
@@ -1948,7 +2195,8 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
     uivector lz77_encoded;
     uivector_init(&lz77_encoded);
     error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
+                       settings->minmatch, settings->nicematch, settings->lazymatching,
+                       settings->maxchainlength);
     if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
     uivector_cleanup(&lz77_encoded);
   }
@@ -1969,45 +2217,75 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+/*
+Deflates in[dictsize..insize-1], with in[0..dictsize-1] as the data that came
+before it in the stream: it is put in the hash chains so matches may reach back
+into it. Unless final, the output ends with an empty stored block, which brings
+it to a byte boundary without ending the stream.
+*/
+static unsigned deflateChunkv(ucvector* out, const unsigned char* in, size_t dictsize, size_t insize,
+                              int final, const LodePNGCompressSettings* settings)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   size_t bp = 0; /*the bit pointer*/
+  size_t datasize = insize - dictsize;
   Hash hash;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
+  else if(settings->btype == 0)
+  {
+    /*stored blocks are byte aligned already, so only the final flag matters*/
+    return deflateNoCompression(out, in + dictsize, datasize, final);
+  }
+  else if(settings->btype == 1) blocksize = datasize > 0 ? datasize : 1; /*one block, even for no data*/
   else /*if(settings->btype == 2)*/
   {
-    blocksize = insize / 8 + 8;
+    blocksize = datasize / 8 + 8;
     if(blocksize < 65535) blocksize = 65535;
   }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
+  numdeflateblocks = (datasize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
   error = hash_init(&hash, settings->windowsize);
   if(error) return error;
 
+  /*only the last window of the dictionary can be referred to*/
+  if(dictsize > settings->windowsize) addHashRange(&hash, in, dictsize - settings->windowsize, dictsize,
+                                                   insize, settings->windowsize);
+  else addHashRange(&hash, in, 0, dictsize, insize, settings->windowsize);
+
   for(i = 0; i < numdeflateblocks && !error; i++)
   {
-    int final = i == numdeflateblocks - 1;
-    size_t start = i * blocksize;
+    int lastblock = i == numdeflateblocks - 1;
+    size_t start = dictsize + i * blocksize;
     size_t end = start + blocksize;
     if(end > insize) end = insize;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final && lastblock);
+    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final && lastblock);
   }
 
   hash_cleanup(&hash);
 
+  if(!error && !final)
+  {
+    /*empty stored block: BFINAL 0, BTYPE 00, padding to the byte boundary, LEN 0 and NLEN 65535*/
+    addBitsToStream(&bp, out, 0, 3);
+    if(!ucvector_push_back(out, 0) || !ucvector_push_back(out, 0)
+    || !ucvector_push_back(out, 255) || !ucvector_push_back(out, 255)) error = 83; /*alloc fail*/
+  }
+
   return error;
 }
 
+static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGCompressSettings* settings)
+{
+  return deflateChunkv(out, in, 0, insize, 1, settings);
+}
+
 unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings)
@@ -2021,6 +2299,20 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
+unsigned lodepng_deflate_chunk(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t dictsize, size_t insize,
+                               int final, const LodePNGCompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  if(dictsize > insize) return 92; /*dictionary bigger than the input it's part of*/
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = deflateChunkv(&v, in, dictsize, insize, final, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
 static unsigned deflate(unsigned char** out, size_t* outsize,
                         const unsigned char* in, size_t insize,
                         const LodePNGCompressSettings* settings)
@@ -2070,6 +2362,41 @@ static unsigned adler32(const unsigned char* data, unsigned len)
   return update_adler32(1L, data, len);
 }
 
+#ifdef LODEPNG_COMPILE_ENCODER
+unsigned lodepng_adler32(const unsigned char* data, size_t len)
+{
+  unsigned adler = 1;
+  /*update_adler32 takes an unsigned length*/
+  while(len > 0)
+  {
+    unsigned amount = len > 1073741824 ? 1073741824 : (unsigned)len;
+    adler = update_adler32(adler, data, amount);
+    data += amount;
+    len -= amount;
+  }
+  return adler;
+}
+
+/*
+The sums of the second part are offset by the first part's: s1 by s1a - 1, and
+s2 by len2 times that plus s2a - 1 (the -1 being for the initial s1 of 1).
+*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned base = 65521;
+  unsigned rem = (unsigned)(len2 % base);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (rem * s1) % base; /*at most 65520 * 65520, which fits in 32 bits*/
+  s1 += (adler2 & 0xffff) + base - 1;
+  s2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+  if(s1 >= base) s1 -= base;
+  if(s1 >= base) s1 -= base;
+  if(s2 >= base * 2) s2 -= base * 2;
+  if(s2 >= base) s2 -= base;
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2229,13 +2556,14 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->maxchainlength = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -4011,6 +4339,12 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+
+#ifdef LODEPNG_COMPILE_SIMD_UNFILTER
+  /*3 and 4 byte pixels with SSE2 or NEON when the CPU has it, see lodepng_unfilter.c*/
+  if(lodepng_unfilter_simd(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /*LODEPNG_COMPILE_SIMD_UNFILTER*/
+
   switch(filterType)
   {
     case 0:
@@ -4072,16 +4406,14 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+/*
+Same as unfilter, but scanline y of the result starts at out + y * stride instead of
+out + y * linebytes. stride must be at least linebytes; bytes between the scanlines
+are not touched. in and out may only be the same memory address if stride is linebytes.
+*/
+static unsigned unfilterStride(unsigned char* out, size_t stride, const unsigned char* in,
+                               unsigned w, unsigned h, unsigned bpp)
 {
-  /*
-  For PNG filter method 0
-  this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 seven times)
-  out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
-  w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
-  in and out are allowed to be the same memory address (but aren't the same size since in has the extra filter bytes)
-  */
-
   unsigned y;
   unsigned char* prevline = 0;
 
@@ -4091,7 +4423,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   for(y = 0; y < h; y++)
   {
-    size_t outindex = linebytes * y;
+    size_t outindex = stride * y;
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
@@ -4103,6 +4435,18 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   return 0;
 }
 
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+{
+  /*
+  For PNG filter method 0
+  this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 seven times)
+  out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
+  w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
+  in and out are allowed to be the same memory address (but aren't the same size since in has the extra filter bytes)
+  */
+  return unfilterStride(out, (w * bpp + 7) / 8, in, w, h, bpp);
+}
+
 /*
 in: Adam7 interlaced image, with no padding bits between scanlines, but between
  reduced images so that each reduced image starts at a byte.
@@ -4551,10 +4895,16 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+/*
+read a PNG, the result will be in the same color type as the PNG (hence "generic")
+If dest is given, a non-interlaced image of at least 8 bits per pixel that needs no color
+conversion is instead unfiltered straight into dest, with stride bytes between the starts of
+its rows, and *out stays 0. dest must be big enough; lodepng_decode_into checks it.
+*/
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+                          const unsigned char* in, size_t insize,
+                          unsigned char* dest, size_t stride)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
@@ -4714,7 +5064,13 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                                      idat.size, &state->decoder.zlibsettings);
     }
 
-    if(!state->error)
+    if(!state->error && dest && state->info_png.interlace_method == 0
+       && lodepng_get_bpp(&state->info_png.color) >= 8
+       && (!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)))
+    {
+      state->error = unfilterStride(dest, stride, scanlines.data, *w, *h, lodepng_get_bpp(&state->info_png.color));
+    }
+    else if(!state->error)
     {
       ucvector outv;
       ucvector_init(&outv);
@@ -4734,7 +5090,7 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         const unsigned char* in, size_t insize)
 {
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
+  decodeGeneric(out, w, h, state, in, insize, 0, 0);
   if(state->error) return state->error;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
   {
@@ -4773,6 +5129,79 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
   return state->error;
 }
 
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t stride,
+                             unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  unsigned char* data = 0;
+  size_t linebytes, i;
+  unsigned bpp;
+  unsigned y;
+
+  state->error = lodepng_inspect(w, h, state, in, insize);
+  if(state->error) return state->error;
+
+  bpp = lodepng_get_bpp(state->decoder.color_convert ? &state->info_raw : &state->info_png.color);
+  /*error: rows that don't start at a byte can't be placed at a stride*/
+  if(bpp % 8 != 0) CERROR_RETURN_ERROR(state->error, 91);
+  linebytes = (size_t)(*w) * (bpp / 8);
+  /*error: out can't hold h rows of linebytes bytes, stride bytes apart*/
+  if(stride < linebytes || linebytes == 0 || outsize < linebytes
+     || (outsize - linebytes) / stride < *h - 1) CERROR_RETURN_ERROR(state->error, 90);
+
+  decodeGeneric(&data, w, h, state, in, insize, out, stride);
+  if(state->error)
+  {
+    lodepng_free(data);
+    return state->error;
+  }
+
+  if(!state->decoder.color_convert)
+  {
+    state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    if(state->error)
+    {
+      lodepng_free(data);
+      return state->error;
+    }
+  }
+
+  /*data is 0 if decodeGeneric already wrote the rows to out*/
+  if(!data) return 0;
+
+  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    for(y = 0; y < *h; y++)
+    {
+      for(i = 0; i < linebytes; i++) out[stride * y + i] = data[linebytes * y + i];
+    }
+  }
+  else
+  {
+    /*same check as in lodepng_decode*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
+    {
+      lodepng_free(data);
+      return 56; /*unsupported color mode conversion*/
+    }
+
+    /*convert to contiguous rows at the start of out, then move them apart from the last one up,
+    so no row is overwritten before it is moved*/
+    state->error = lodepng_convert(out, data, &state->info_raw, &state->info_png.color, *w, *h, state->decoder.fix_png);
+    if(!state->error && stride != linebytes)
+    {
+      for(y = *h; y > 0; y--)
+      {
+        /*backwards too within the row, which may overlap where it moves to*/
+        for(i = linebytes; i > 0; i--) out[stride * (y - 1) + i - 1] = out[linebytes * (y - 1) + i - 1];
+      }
+    }
+  }
+  lodepng_free(data);
+  return state->error;
+}
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -4796,6 +5225,19 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
   return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
 }
 
+unsigned lodepng_decode32_into(unsigned char* out, size_t outsize, size_t stride,
+                               unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+{
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  state.info_raw.colortype = LCT_RGBA;
+  state.info_raw.bitdepth = 8;
+  error = lodepng_decode_into(out, outsize, stride, w, h, &state, in, insize);
+  lodepng_state_cleanup(&state);
+  return error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth)
@@ -5260,14 +5702,16 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   if(bpp == 0) return 31; /*error: invalid color type*/
 
-  if(strategy == LFS_ZERO)
+  if(strategy == LFS_ZERO || strategy == LFS_FIXED)
   {
+    unsigned type = strategy == LFS_ZERO ? 0 : settings->fixed_filter;
+    if(type > 4) return 88; /*error: there are only 5 filter types*/
     for(y = 0; y < h; y++)
     {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
-      out[outindex] = 0; /*filter type byte*/
-      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, 0);
+      out[outindex] = type; /*filter type byte*/
+      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, type);
       prevline = &in[inindex];
     }
   }
@@ -5900,6 +6344,7 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   lodepng_compress_settings_init(&settings->zlibsettings);
   settings->filter_palette_zero = 1;
   settings->filter_strategy = LFS_MINSUM;
+  settings->fixed_filter = 4;
   settings->auto_convert = LAC_AUTO;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
@@ -6014,6 +6459,9 @@ const char* lodepng_error_text(unsigned code)
     case 87: return "must provide custom zlib function pointer if LODEPNG_COMPILE_ZLIB is not defined";
     case 88: return "invalid filter strategy given for LodePNGEncoderSettings.filter_strategy";
     case 89: return "text chunk keyword too short or long: must have size 1-79";
+    case 90: return "output buffer too small for the image at the given row stride";
+    case 91: return "decoding into a buffer with a row stride needs a whole number of bytes per pixel";
+    case 92: return "deflate chunk dictionary is bigger than the input it is part of";
   }
   return "unknown error code";
 }
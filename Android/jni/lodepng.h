@@ -131,6 +131,15 @@ unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h,
 unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h,
                           const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode32, but decodes into out, a buffer of outsize bytes owned by the
+caller, instead of allocating one. Row y of the image starts at out + y * stride. See
+lodepng_decode_into.
+*/
+unsigned lodepng_decode32_into(unsigned char* out, size_t outsize, size_t stride,
+                               unsigned* w, unsigned* h,
+                               const unsigned char* in, size_t insize);
+
 #ifdef LODEPNG_COMPILE_DISK
 /*
 Load PNG from disk, from file with given name.
@@ -294,6 +303,9 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*most earlier positions tried per match search, lower is faster. Default: 0, meaning windowsize
+  if that is at least 8192, windowsize / 8 otherwise*/
+  unsigned maxchainlength;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -555,7 +567,9 @@ typedef enum LodePNGFilterStrategy
   */
   LFS_BRUTE_FORCE,
   /*use predefined_filters buffer: you specify the filter type for each scanline*/
-  LFS_PREDEFINED
+  LFS_PREDEFINED,
+  /*use filter type fixed_filter for every scanline: no cost to choose one, unlike MINSUM or ENTROPY*/
+  LFS_FIXED
 } LodePNGFilterStrategy;
 
 /*automatically use color type with less bits per pixel if losslessly possible. Default: LAC_AUTO*/
@@ -601,6 +615,8 @@ typedef struct LodePNGEncoderSettings
   have to cleanup this buffer, LodePNG will never free it. Don't forget that filter_palette_zero
   must be set to 0 to ensure this is also used on palette or low bitdepth images.*/
   unsigned char* predefined_filters;
+  /*the filter type, 0-4, used for all scanlines if filter_strategy is LFS_FIXED. Default: 4 (Paeth)*/
+  unsigned fixed_filter;
 
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
@@ -651,6 +667,21 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode, but decodes into out, a buffer of outsize bytes owned by the
+caller, with row y of the image starting at out + y * stride. Use lodepng_inspect first
+to get the size to make out. This places the image inside a bigger one, like a texture
+padded to a power of two; the bytes between the rows may be overwritten.
+The raw color mode must have a whole number of bytes per pixel. Non-interlaced images
+needing no color conversion are unfiltered straight into out, without allocating a
+second image; others are decoded as usual and then converted into out.
+Returns error 90 if out is too small, 91 for a color mode with less than a byte per pixel.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t stride,
+                             unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -783,6 +814,27 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Compresses one piece of a larger deflate stream, so that the pieces of a big
+buffer can be compressed on several threads and then simply concatenated.
+in[dictsize..insize-1] is the piece, in[0..dictsize-1] is (the end of) the data
+before it, which LZ77 matches may refer back to; no more than windowsize bytes
+of it are needed. Only the last piece is given final: the others end with an
+empty stored block (a "sync flush"), leaving them on a byte boundary.
+The zlib header and Adler32 around the pieces are up to the caller, see
+lodepng_adler32 and lodepng_adler32_combine.
+*/
+unsigned lodepng_deflate_chunk(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t dictsize, size_t insize,
+                               int final, const LodePNGCompressSettings* settings);
+
+/*Return the Adler32 of data[0..len-1], as used in the zlib trailer.*/
+unsigned lodepng_adler32(const unsigned char* data, size_t len);
+
+/*Return the Adler32 of two buffers one after the other, given the Adler32 of each
+and the length of the second.*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
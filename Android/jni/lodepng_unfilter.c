@@ -0,0 +1,190 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "lodepng_unfilter.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(LODEPNG_UNFILTER_NEON) && defined(__arm__)
+#include <cpu-features.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/*
+Pixels are handled one at a time in the low lanes, since each depends on the
+one before it, except Up which has no such dependency. 4 bytes are read even
+for 3 byte pixels, except at the end of the scanline, and 3 byte pixels are
+written with memcpy, since recon may be scanline. The callers pass bytewidth
+as a constant so these inline to a plain load or store.
+*/
+static __m128i loadPixel(const unsigned char* p, size_t i, size_t bytewidth, size_t length)
+{
+  int value = 0;
+  if(bytewidth == 4 || i + 4 <= length) memcpy(&value, &p[i], 4);
+  else memcpy(&value, &p[i], 3);
+  return _mm_cvtsi32_si128(value);
+}
+
+static void storePixel(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  int value = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else memcpy(p, &value, 3);
+}
+
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i = 0;
+  __m128i a = _mm_setzero_si128();
+  if(bytewidth == 4)
+  {
+    /*four pixels at a time: a prefix sum over the pixels, plus the one before them*/
+    for(; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, a);
+      _mm_storeu_si128((__m128i*)&recon[i], x);
+      a = _mm_shuffle_epi32(x, 0xff);
+    }
+  }
+  for(; i < length; i += bytewidth)
+  {
+    a = _mm_add_epi8(loadPixel(scanline, i, bytewidth, length), a);
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+  }
+  for(; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = loadPixel(precon, i, bytewidth, length);
+    /*_mm_avg_epu8 rounds up, the filter rounds down*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixel(scanline, i, bytewidth, length), avg);
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static __m128i abs16(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static __m128i select16(__m128i mask, __m128i yes, __m128i no)
+{
+  return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+}
+
+/*in 16 bit lanes, with the same comparisons as paethPredictor in lodepng.c*/
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(precon, i, bytewidth, length), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixel(scanline, i, bytewidth, length), zero);
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = abs16(_mm_add_epi16(pa, pb));
+    __m128i pred;
+    pa = abs16(pa);
+    pb = abs16(pb);
+    pred = select16(_mm_cmplt_epi16(pb, pa), b, a);
+    pred = select16(_mm_and_si128(_mm_cmplt_epi16(pc, pa), _mm_cmplt_epi16(pc, pb)), c, pred);
+    x = _mm_packus_epi16(_mm_and_si128(_mm_add_epi16(x, pred), _mm_set1_epi16(0xff)), zero);
+    storePixel(&recon[i], x, bytewidth);
+    a = _mm_unpacklo_epi8(x, zero);
+    c = b;
+  }
+}
+
+static int unfilterSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                        size_t bytewidth, unsigned char filterType, size_t length)
+{
+  switch(filterType)
+  {
+    case 1:
+      if(bytewidth == 4) unfilterSubSSE2(recon, scanline, 4, length);
+      else unfilterSubSSE2(recon, scanline, 3, length);
+      return 1;
+    case 2:
+      unfilterUpSSE2(recon, scanline, precon, length);
+      return 1;
+    case 3:
+      if(bytewidth == 4) unfilterAverageSSE2(recon, scanline, precon, 4, length);
+      else unfilterAverageSSE2(recon, scanline, precon, 3, length);
+      return 1;
+    case 4:
+      if(bytewidth == 4) unfilterPaethSSE2(recon, scanline, precon, 4, length);
+      else unfilterPaethSSE2(recon, scanline, precon, 3, length);
+      return 1;
+    default: return 0;
+  }
+}
+#endif /*__SSE2__*/
+
+typedef int (*UnfilterFunction)(unsigned char*, const unsigned char*, const unsigned char*,
+                                size_t, unsigned char, size_t);
+
+static UnfilterFunction simdUnfilter = 0;
+static pthread_once_t simdUnfilterOnce = PTHREAD_ONCE_INIT;
+
+/*armeabi-v7a devices without NEON exist, so it is checked for there*/
+static void chooseUnfilter(void)
+{
+#if defined(LODEPNG_UNFILTER_NEON) && defined(__arm__)
+  if(android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM
+  && (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON)) simdUnfilter = lodepng_unfilter_neon;
+#elif defined(LODEPNG_UNFILTER_NEON)
+  simdUnfilter = lodepng_unfilter_neon;
+#elif defined(__SSE2__)
+  simdUnfilter = unfilterSSE2;
+#endif
+}
+
+int lodepng_unfilter_simd(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                          size_t bytewidth, unsigned char filterType, size_t length)
+{
+  /*without a previous scanline the filters are trivial, and left to the scalar code*/
+  if((bytewidth != 3 && bytewidth != 4) || !precon) return 0;
+  pthread_once(&simdUnfilterOnce, chooseUnfilter);
+  if(!simdUnfilter) return 0;
+  return simdUnfilter(recon, scanline, precon, bytewidth, filterType, length);
+}
@@ -0,0 +1,35 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef LODEPNG_UNFILTER_H
+#define LODEPNG_UNFILTER_H
+
+#include <stddef.h>
+
+/*
+Vectorized PNG unfiltering for lodepng's unfilterScanline, for 3 and 4 bytes
+per pixel. Takes the same arguments. Returns 1 if the scanline was unfiltered,
+or 0 if the scalar code must do it: other pixel sizes, the first scanline,
+unknown filter types, or no SIMD on this CPU. The SSE2 or NEON code is chosen
+once, at the first call. Gives the same bytes as the scalar code.
+*/
+int lodepng_unfilter_simd(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                          size_t bytewidth, unsigned char filterType, size_t length);
+
+/*the NEON version, in lodepng_unfilter_neon.c, only called if the CPU has NEON*/
+int lodepng_unfilter_neon(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                          size_t bytewidth, unsigned char filterType, size_t length);
+
+#endif /*LODEPNG_UNFILTER_H*/
@@ -0,0 +1,147 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+/*
+Built with NEON enabled, as lodepng_unfilter_neon.c.neon on armeabi-v7a, so
+nothing else may go in this file: lodepng_unfilter.c only calls it after
+checking the CPU has NEON. See lodepng_unfilter.c for the SSE2 version.
+*/
+
+#include "lodepng_unfilter.h"
+#include <string.h>
+#include <arm_neon.h>
+
+/*
+The pixel in the low lanes. As in lodepng_unfilter.c, 4 bytes are read even
+for 3 byte pixels, except at the end of the scanline, and 3 byte pixels are
+written with memcpy, since recon may be scanline.
+*/
+static uint8x8_t loadPixel(const unsigned char* p, size_t i, size_t bytewidth, size_t length)
+{
+  uint32_t value = 0;
+  if(bytewidth == 4 || i + 4 <= length) memcpy(&value, &p[i], 4);
+  else memcpy(&value, &p[i], 3);
+  return vcreate_u8(value);
+}
+
+static void storePixel(unsigned char* p, uint8x8_t pixel, size_t bytewidth)
+{
+  uint32_t value = vget_lane_u32(vreinterpret_u32_u8(pixel), 0);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else memcpy(p, &value, 3);
+}
+
+static void unfilterSubNEON(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i = 0;
+  uint8x8_t a = vdup_n_u8(0);
+  if(bytewidth == 4)
+  {
+    /*four pixels at a time: a prefix sum over the pixels, plus the one before them*/
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uint8x16_t prev = zero;
+    for(; i + 16 <= length; i += 16)
+    {
+      uint8x16_t x = vld1q_u8(&scanline[i]);
+      x = vaddq_u8(x, vextq_u8(zero, x, 12));
+      x = vaddq_u8(x, vextq_u8(zero, x, 8));
+      x = vaddq_u8(x, prev);
+      vst1q_u8(&recon[i], x);
+      prev = vreinterpretq_u8_u32(vdupq_n_u32(vgetq_lane_u32(vreinterpretq_u32_u8(x), 3)));
+    }
+    a = vget_low_u8(prev);
+  }
+  for(; i < length; i += bytewidth)
+  {
+    a = vadd_u8(loadPixel(scanline, i, bytewidth, length), a);
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterUpNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    vst1q_u8(&recon[i], vaddq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&precon[i])));
+  }
+  for(; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  uint8x8_t a = vdup_n_u8(0);
+  for(i = 0; i < length; i += bytewidth)
+  {
+    /*vhadd rounds down, like the filter*/
+    a = vadd_u8(loadPixel(scanline, i, bytewidth, length), vhadd_u8(a, loadPixel(precon, i, bytewidth, length)));
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+/*in 16 bit lanes, with the same comparisons as paethPredictor in lodepng.c*/
+static void unfilterPaethNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  size_t i;
+  int16x8_t a = vdupq_n_s16(0), c = vdupq_n_s16(0);
+  for(i = 0; i < length; i += bytewidth)
+  {
+    int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(loadPixel(precon, i, bytewidth, length)));
+    int16x8_t x = vreinterpretq_s16_u16(vmovl_u8(loadPixel(scanline, i, bytewidth, length)));
+    int16x8_t pa = vsubq_s16(b, c);
+    int16x8_t pb = vsubq_s16(a, c);
+    int16x8_t pc = vabsq_s16(vaddq_s16(pa, pb));
+    int16x8_t pred;
+    uint8x8_t pixel;
+    pa = vabsq_s16(pa);
+    pb = vabsq_s16(pb);
+    pred = vbslq_s16(vcltq_s16(pb, pa), b, a);
+    pred = vbslq_s16(vandq_u16(vcltq_s16(pc, pa), vcltq_s16(pc, pb)), c, pred);
+    /*narrowing keeps the low byte, the sum modulo 256*/
+    pixel = vmovn_u16(vreinterpretq_u16_s16(vaddq_s16(x, pred)));
+    storePixel(&recon[i], pixel, bytewidth);
+    a = vreinterpretq_s16_u16(vmovl_u8(pixel));
+    c = b;
+  }
+}
+
+int lodepng_unfilter_neon(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                          size_t bytewidth, unsigned char filterType, size_t length)
+{
+  /*bytewidth is passed as a constant so loadPixel and storePixel inline to a plain load or store*/
+  switch(filterType)
+  {
+    case 1:
+      if(bytewidth == 4) unfilterSubNEON(recon, scanline, 4, length);
+      else unfilterSubNEON(recon, scanline, 3, length);
+      return 1;
+    case 2:
+      unfilterUpNEON(recon, scanline, precon, length);
+      return 1;
+    case 3:
+      if(bytewidth == 4) unfilterAverageNEON(recon, scanline, precon, 4, length);
+      else unfilterAverageNEON(recon, scanline, precon, 3, length);
+      return 1;
+    case 4:
+      if(bytewidth == 4) unfilterPaethNEON(recon, scanline, precon, 4, length);
+      else unfilterPaethNEON(recon, scanline, precon, 3, length);
+      return 1;
+    default: return 0;
+  }
+}
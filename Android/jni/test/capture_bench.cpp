@@ -0,0 +1,132 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Encoding 1280x720 captures with each CaptureParams::Compression preset,
+// through the whole capture path: QueueCaptureGLLayer, the read back at
+// the end of a frame, and CaptureWriter's encode on its own thread. The
+// frame is screen-like: a sky gradient, flat panels, textured sprites
+// and a little noise. Every PNG is decoded and checked against it.
+
+#include "Canvas.h"
+#include "commands.h"
+#include "test.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+extern "C" {
+#include "lodepng.h"
+}
+
+static const int kWidth = 1280;
+static const int kHeight = 720;
+static const int kRuns = 5;
+
+static unsigned gSeed = 1;
+
+static unsigned Random()
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return gSeed >> 16;
+}
+
+// Top row first
+static unsigned char *MakeScreen()
+{
+    unsigned char *screen = (unsigned char *)malloc( kWidth * kHeight * 4 );
+    for ( int y = 0; y < kHeight; y++ ) {
+        for ( int x = 0; x < kWidth; x++ ) {
+            unsigned char *p = screen + (y * kWidth + x) * 4;
+            p[0] = (unsigned char)(40 + y / 8);
+            p[1] = (unsigned char)(90 + y / 6);
+            p[2] = (unsigned char)(200 - y / 10);
+            p[3] = 255;
+        }
+    }
+    // Panels, then sprites with a pattern and some noise on top
+    for ( int i = 0; i < 200; i++ ) {
+        bool sprite = i >= 20;
+        int w = sprite ? 16 + Random() % 96 : 100 + Random() % 300;
+        int h = sprite ? 16 + Random() % 96 : 40 + Random() % 120;
+        int left = Random() % (kWidth - w);
+        int top = Random() % (kHeight - h);
+        unsigned char color[3] = { (unsigned char)Random(), (unsigned char)Random(), (unsigned char)Random() };
+        for ( int y = top; y < top + h; y++ ) {
+            for ( int x = left; x < left + w; x++ ) {
+                unsigned char *p = screen + (y * kWidth + x) * 4;
+                int shade = sprite ? ((x - left) ^ (y - top)) % 32 + Random() % 8 : 0;
+                for ( int c = 0; c < 3; c++ ) {
+                    p[c] = (unsigned char)(color[c] / 2 + shade * (c + 1));
+                }
+            }
+        }
+    }
+    return screen;
+}
+
+int main()
+{
+    static const char *names[] = { "store", "fast", "default", "best" };
+
+    unsigned char *screen = MakeScreen();
+    // glReadPixels gives the bottom row first
+    unsigned char *framebuffer = (unsigned char *)malloc( kWidth * kHeight * 4 );
+    for ( int y = 0; y < kHeight; y++ ) {
+        memcpy( framebuffer + y * kWidth * 4, screen + (kHeight - 1 - y) * kWidth * 4, kWidth * 4 );
+    }
+    gFramebuffer = framebuffer;
+
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( kWidth, kHeight );
+    CommandWriter frame;
+    frame.SetTransform( 1, 0, 0, 1, 0, 0 );
+
+    printf( "capture_bench: %dx%d PNG captures, best of %d\n", kWidth, kHeight, kRuns );
+    for ( int preset = CaptureParams::COMPRESS_STORE; preset <= CaptureParams::COMPRESS_BEST; preset++ ) {
+        double best = 1e30, frameBest = 1e30;
+        size_t size = 0;
+        bool matches = true;
+        for ( int run = 0; run < kRuns; run++ ) {
+            canvas->QueueCaptureGLLayer( 0, 0, -1, -1, "capture", "", preset, CaptureParams::OUTPUT_PNG );
+            double start = NowMs();
+            canvas->RenderBinary( frame.GetData(), frame.GetSize() );
+            double frameMs = NowMs() - start;
+            Callback *cb;
+            while ( !(cb = canvas->GetNextCallback()) ) {
+                sched_yield();
+            }
+            double ms = NowMs() - start;
+            if ( ms < best ) best = ms;
+            if ( frameMs < frameBest ) frameBest = frameMs;
+
+            unsigned char *decoded = NULL;
+            unsigned w, h;
+            matches &= !cb->isError
+                       && !lodepng_decode32( &decoded, &w, &h, cb->data, cb->dataSize )
+                       && w == (unsigned)kWidth && h == (unsigned)kHeight
+                       && !memcmp( decoded, screen, kWidth * kHeight * 4 );
+            free( decoded );
+            size = cb->dataSize;
+            canvas->PopCallbacks();
+        }
+        printf( "%-8s %7.1f ms  %8.1f KB   frame with the capture %5.2f ms%s\n", names[preset], best, size / 1024.0,
+                frameBest, matches ? "" : "   WRONG PIXELS" );
+    }
+
+    Canvas::Release();
+    gFramebuffer = NULL;
+    free( framebuffer );
+    free( screen );
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+// Builds frames in the binary command format FastCanvas.js sends, for
+// the benchmarks that drive Canvas::RenderBinary.
+
+#ifndef _Included_commands
+#define _Included_commands
+
+#include <string>
+
+class CommandWriter
+{
+public:
+    void Command( char cmd )    { bytes += cmd; }
+    void Int( int value )       { bytes.append( (const char *)&value, sizeof(value) ); }
+    void Float( float value )   { bytes.append( (const char *)&value, sizeof(value) ); }
+
+    void SetTransform( float a, float b, float c, float d, float tx, float ty ) {
+        Command( 't' );
+        Float( a );
+        Float( b );
+        Float( c );
+        Float( d );
+        Float( tx );
+        Float( ty );
+    }
+    void DrawImage( int id, float sx, float sy, float sw, float sh,
+                    float dx, float dy, float dw, float dh ) {
+        Command( 'd' );
+        Int( id );
+        Float( sx );
+        Float( sy );
+        Float( sw );
+        Float( sh );
+        Float( dx );
+        Float( dy );
+        Float( dw );
+        Float( dh );
+    }
+
+    const unsigned char *GetData() const    { return (const unsigned char *)bytes.data(); }
+    int     GetSize() const                 { return (int)bytes.size(); }
+
+    std::string bytes;
+};
+
+#endif // _Included_commands
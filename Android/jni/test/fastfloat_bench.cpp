@@ -0,0 +1,90 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Number parsing throughput of Canvas::FastFloat against strtod, over
+// the kinds of numbers FastCanvas.js writes into a frame.
+
+#include "Canvas.h"
+#include "test.h"
+#include <string>
+
+static const int kNumbers = 1000000;
+static const int kRuns = 5;
+
+// Parses every comma separated number in text; returns their sum so the
+// work can't be optimized away
+template <typename Parse>
+static double ParseAll( const std::string &text, Parse parse, double *bestMs )
+{
+    double sum = 0;
+    *bestMs = 1e30;
+    for ( int run = 0; run < kRuns; run++ ) {
+        double start = NowMs();
+        const char *p = text.c_str();
+        sum = 0;
+        while ( *p ) {
+            sum += parse( p, &p );
+            if ( *p == ',' ) ++p;
+        }
+        double ms = NowMs() - start;
+        if ( ms < *bestMs ) *bestMs = ms;
+    }
+    return sum;
+}
+
+static float Fast( const char *p, const char **end )
+{
+    return Canvas::FastFloat( p, end );
+}
+
+static float Strtod( const char *p, const char **end )
+{
+    return (float)strtod( p, (char **)end );
+}
+
+static void Bench( const char *name, const char *format, double scale )
+{
+    std::string text;
+    char buffer[64];
+    unsigned int seed = 1;
+    for ( int i = 0; i < kNumbers; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        double d = ((int)(seed >> 1) - 0x40000000) * scale;
+        if ( format ) {
+            snprintf( buffer, sizeof(buffer), format, d );
+        } else {
+            snprintf( buffer, sizeof(buffer), "%d", (int)d );
+        }
+        text += buffer;
+        text += ',';
+    }
+
+    double fastMs, strtodMs;
+    double fastSum = ParseAll( text, Fast, &fastMs );
+    double strtodSum = ParseAll( text, Strtod, &strtodMs );
+    printf( "%-26s FastFloat %6.1f ns/number   strtod %6.1f ns/number   %s\n", name,
+            fastMs * 1e6 / kNumbers, strtodMs * 1e6 / kNumbers,
+            fastSum == strtodSum ? "" : "(sums differ)" );
+}
+
+int main()
+{
+    printf( "fastfloat_bench: %d numbers, best of %d runs\n", kNumbers, kRuns );
+    Bench( "integers", NULL, 1e-5 );
+    Bench( "toFixed(6)", "%.6f", 1e-5 );
+    Bench( "toString(), 17 digits", "%.17g", 1e-5 );
+    Bench( "small, with exponent", "%.17g", 1e-15 );
+    return 0;
+}
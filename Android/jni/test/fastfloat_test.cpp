@@ -0,0 +1,93 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Canvas::FastFloat and FastInt against strtod and strtol, value and end
+// pointer, over the number formats FastCanvas.js writes.
+
+#include "Canvas.h"
+#include "test.h"
+#include <math.h>
+
+static void CheckFloat( const char *text )
+{
+    const char *end;
+    float value = Canvas::FastFloat( text, &end );
+    char *expectedEnd;
+    float expected = (float)strtod( text, &expectedEnd );
+
+    // Same bits, so -0 has to come back as -0
+    bool same = (value == expected) && (signbit(value) == signbit(expected));
+    if ( !same || end != expectedEnd ) {
+        fprintf( stderr, "FastFloat(\"%s\") = %.9g, %d chars; strtod %.9g, %d chars\n",
+                 text, value, (int)(end - text), expected, (int)(expectedEnd - text) );
+    }
+    CHECK( same );
+    CHECK( end == expectedEnd );
+}
+
+static void CheckInt( const char *text )
+{
+    const char *end;
+    int value = Canvas::FastInt( text, &end );
+    char *expectedEnd;
+    long expected = strtol( text, &expectedEnd, 10 );
+    CHECK( value == expected );
+    CHECK( end == expectedEnd );
+}
+
+int main()
+{
+    // Edge cases of the grammar, and what must not be consumed
+    static const char *floats[] = {
+        "0", "-0", "+0", "1", "-1", "0.0", "-0.000000", ".5", "-.5", "1.", "-1.",
+        "10.5", "0.000001", "-3.141593", "1e-7", "1.5e+21", "2E10", "1e", "1e+", "5e-",
+        "123456789012345678901234", "0.1234567890123456789012",
+        "00000000000000000000000000001.5", "1.00000000000000000000000000001",
+        "99999999999999999999.999999", "340282346638528859811704183484516925440",
+        "1e-45", "1e-50", "4.5;", "7,8", "-", "+", ".", "-.", "", "x1",
+        "210.73818206787107", "-210.73818206787107"
+    };
+    for ( size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++ ) {
+        CheckFloat( floats[i] );
+    }
+
+    static const char *ints[] = {
+        "0", "-0", "7", "-42", "+3", "2147483647", "-2147483647", "12;", "1.5", "-", "", "a"
+    };
+    for ( size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++ ) {
+        CheckInt( ints[i] );
+    }
+
+    // What Number.toString() and toFixed(6) give for typical coordinates,
+    // scales and angles
+    char buffer[64];
+    unsigned int seed = 1;
+    for ( int i = 0; i < 1000000; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        double d = ((int)(seed >> 1) - 0x40000000) / 10737.41824; // +-100000
+        switch ( i % 4 ) {
+        case 0: snprintf( buffer, sizeof(buffer), "%.6f", d ); break;
+        case 1: snprintf( buffer, sizeof(buffer), "%d", (int)d ); break;
+        case 2: snprintf( buffer, sizeof(buffer), "%.17g", d ); break;
+        case 3: snprintf( buffer, sizeof(buffer), "%.17g", d * 1e-12 ); break;
+        }
+        CheckFloat( buffer );
+        if ( gFailures > 20 ) {
+            break;
+        }
+    }
+
+    return TestResult( "fastfloat_test" );
+}
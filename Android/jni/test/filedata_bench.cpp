@@ -0,0 +1,144 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Loading PNG files for addPngTexture: FileData::OpenFile, which maps the
+// file, against reading it into a malloc'd buffer, which is what the JNI
+// code did before. Timed for the load alone, touching every byte as the
+// decoder does, and for the load plus AddPngTexture. Files are in the
+// page cache after the first run, as textures reloaded after a lost
+// context would be.
+
+#include "Canvas.h"
+#include "test.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+extern "C" {
+#include "lodepng.h"
+}
+
+static const int kRuns = 20;
+
+// What the bytes add up to, so that reading them can't be skipped
+static unsigned Touch( const unsigned char *data, long size )
+{
+    unsigned sum = 0;
+    for ( long i = 0; i < size; i++ ) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// The old path: the whole file copied into the heap
+static unsigned char *ReadFile( const char *path, long *size )
+{
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 ) return NULL;
+    *size = (long)lseek( fd, 0, SEEK_END );
+    lseek( fd, 0, SEEK_SET );
+    unsigned char *buffer = (unsigned char *)malloc( *size );
+    if ( buffer && read( fd, buffer, *size ) != *size ) {
+        free( buffer );
+        buffer = NULL;
+    }
+    close( fd );
+    return buffer;
+}
+
+static void WritePng( const char *path, unsigned width, unsigned height, long *size )
+{
+    unsigned char *image = (unsigned char *)malloc( (size_t)width * height * 4 );
+    unsigned seed = 1;
+    for ( size_t i = 0; i < (size_t)width * height * 4; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        image[i] = (unsigned char)(( i % 4 == 3 ) ? 255 : ( i % (width * 4) ) / 5 + ( i / (width * 4) ) / 3 + ( seed >> 16 ) % 6);
+    }
+    unsigned char *png = NULL;
+    size_t pngSize = 0;
+    lodepng_encode32( &png, &pngSize, image, width, height );
+    lodepng_save_file( png, pngSize, path );
+    *size = (long)pngSize;
+    free( png );
+    free( image );
+}
+
+static void Bench( Canvas *canvas, unsigned width, unsigned height )
+{
+    char path[] = "/tmp/filedata_benchXXXXXX";
+    int fd = mkstemp( path );
+    if ( fd < 0 ) {
+        printf( "can't create %s\n", path );
+        return;
+    }
+    close( fd );
+    long fileSize;
+    WritePng( path, width, height, &fileSize );
+
+    double readMs = 1e30, mapMs = 1e30, readDecodeMs = 1e30, mapDecodeMs = 1e30;
+    unsigned readSum = 0, mapSum = 0;
+    bool decoded = true;
+    for ( int run = 0; run < kRuns; run++ ) {
+        double start = NowMs();
+        long size;
+        unsigned char *buffer = ReadFile( path, &size );
+        readSum = Touch( buffer, size );
+        free( buffer );
+        double ms = NowMs() - start;
+        if ( ms < readMs ) readMs = ms;
+
+        start = NowMs();
+        FileData file;
+        file.OpenFile( path );
+        mapSum = Touch( file.GetData(), file.GetSize() );
+        file.Close();
+        ms = NowMs() - start;
+        if ( ms < mapMs ) mapMs = ms;
+
+        unsigned int w, h;
+        start = NowMs();
+        buffer = ReadFile( path, &size );
+        decoded &= canvas->AddPngTexture( buffer, size, 1, &w, &h );
+        free( buffer );
+        ms = NowMs() - start;
+        if ( ms < readDecodeMs ) readDecodeMs = ms;
+
+        start = NowMs();
+        file.OpenFile( path );
+        decoded &= canvas->AddPngTexture( file.GetData(), file.GetSize(), 1, &w, &h );
+        file.Close();
+        ms = NowMs() - start;
+        if ( ms < mapDecodeMs ) mapDecodeMs = ms;
+    }
+    unlink( path );
+
+    if ( readSum != mapSum || !decoded ) {
+        printf( "%ux%u: the two paths disagree\n", width, height );
+    }
+    printf( "%4ux%-4u %6ld KB   load: read %7.3f ms  map %7.3f ms   load+decode: read %7.2f ms  map %7.2f ms\n",
+            width, height, fileSize / 1024, readMs, mapMs, readDecodeMs, mapDecodeMs );
+}
+
+int main()
+{
+    printf( "filedata_bench: best of %d runs\n", kRuns );
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( 1280, 720 );
+    Bench( canvas, 64, 64 );
+    Bench( canvas, 512, 512 );
+    Bench( canvas, 1280, 720 );
+    Bench( canvas, 2048, 2048 );
+    Canvas::Release();
+    return 0;
+}
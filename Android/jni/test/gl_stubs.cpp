@@ -0,0 +1,104 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// No-op versions of the GL ES 1.1 calls the native code makes, so it
+// runs on the host without a context. Draws, uploads and texture
+// deletes are counted. glReadPixels returns gFramebuffer when it is set.
+
+#include <GLES/gl.h>
+#include <string.h>
+
+static const int kViewportWidth = 1280;
+static const int kViewportHeight = 720;
+
+extern "C" {
+
+int gDrawCalls = 0;
+long gUploadBytes = 0;
+int gTexturesDeleted = 0;
+const unsigned char *gFramebuffer = NULL;
+
+static GLuint gNextName = 1;
+
+void glGenBuffers( GLsizei n, GLuint *names )   { for (int i = 0; i < n; i++) names[i] = gNextName++; }
+void glGenTextures( GLsizei n, GLuint *names )  { for (int i = 0; i < n; i++) names[i] = gNextName++; }
+void glDeleteBuffers( GLsizei, const GLuint * ) {}
+void glDeleteTextures( GLsizei n, const GLuint * ) { gTexturesDeleted += n; }
+void glBindBuffer( GLenum, GLuint ) {}
+void glBindTexture( GLenum, GLuint ) {}
+void glBufferData( GLenum, GLsizeiptr size, const void *, GLenum ) { gUploadBytes += size; }
+void glTexImage2D( GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void * ) {}
+void glTexSubImage2D( GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, const void * ) {}
+void glTexParameterf( GLenum, GLenum, GLfloat ) {}
+void glMatrixMode( GLenum ) {}
+void glLoadIdentity() {}
+void glLoadMatrixf( const GLfloat * ) {}
+void glScalef( GLfloat, GLfloat, GLfloat ) {}
+void glOrthof( GLfloat, GLfloat, GLfloat, GLfloat, GLfloat, GLfloat ) {}
+void glClearColor( GLfloat, GLfloat, GLfloat, GLfloat ) {}
+void glClearDepthf( GLfloat ) {}
+void glClear( GLbitfield ) {}
+void glEnable( GLenum ) {}
+void glDisable( GLenum ) {}
+void glShadeModel( GLenum ) {}
+void glBlendFunc( GLenum, GLenum ) {}
+void glDepthFunc( GLenum ) {}
+void glViewport( GLint, GLint, GLsizei, GLsizei ) {}
+void glEnableClientState( GLenum ) {}
+void glDisableClientState( GLenum ) {}
+void glColor4ub( GLubyte, GLubyte, GLubyte, GLubyte ) {}
+void glVertexPointer( GLint, GLenum, GLsizei, const void * ) {}
+void glTexCoordPointer( GLint, GLenum, GLsizei, const void * ) {}
+void glColorPointer( GLint, GLenum, GLsizei, const void * ) {}
+void glDrawElements( GLenum, GLsizei, GLenum, const void * ) { gDrawCalls++; }
+void glDrawArrays( GLenum, GLint, GLsizei ) { gDrawCalls++; }
+GLenum glGetError() { return GL_NO_ERROR; }
+
+void glGetIntegerv( GLenum pname, GLint *params )
+{
+    if ( pname == GL_VIEWPORT ) {
+        params[0] = 0;
+        params[1] = 0;
+        params[2] = kViewportWidth;
+        params[3] = kViewportHeight;
+    } else {
+        params[0] = 0;
+    }
+}
+
+// gFramebuffer if set, else a fixed pattern, so captures compress like a
+// real frame would rather than like all zeros
+void glReadPixels( GLint x, GLint y, GLsizei width, GLsizei height, GLenum, GLenum, void *pixels )
+{
+    unsigned char *p = (unsigned char *)pixels;
+    if ( gFramebuffer ) {
+        for ( int row = 0; row < height; row++ ) {
+            memcpy( p + row * width * 4, gFramebuffer + ((y + row) * kViewportWidth + x) * 4, width * 4 );
+        }
+        return;
+    }
+    for ( int row = 0; row < height; row++ ) {
+        for ( int col = 0; col < width; col++ ) {
+            int u = x + col;
+            int v = y + row;
+            *p++ = (unsigned char)(u ^ v);
+            *p++ = (unsigned char)((u >> 3) * 5 + v);
+            *p++ = (unsigned char)((v >> 4) * 40);
+            *p++ = 255;
+        }
+    }
+}
+
+}
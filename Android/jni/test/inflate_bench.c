@@ -0,0 +1,109 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+/*
+Decode speed of lodepng: its inflate on an image-like zlib stream, with zlib's
+for reference, and whole PNG decodes, which add unfiltering.
+*/
+
+#include "lodepng.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+static const int kRuns = 5;
+
+/*RGBA, a gradient with noise, compressing about like a game sprite sheet*/
+static unsigned char *MakeImage(unsigned width, unsigned height)
+{
+    unsigned char *image = (unsigned char *)malloc((size_t)width * height * 4);
+    unsigned seed = 1;
+    size_t i;
+    for (i = 0; i < (size_t)width * height * 4; i++) {
+        seed = seed * 1103515245 + 12345;
+        image[i] = (unsigned char)((i % 4 == 3) ? 255 : (i % (width * 4)) / 5 + (i / (width * 4)) / 3 + (seed >> 16) % 6);
+    }
+    return image;
+}
+
+static void BenchInflate(void)
+{
+    static const size_t kSize = 8 * 1024 * 1024;
+    unsigned char *data = MakeImage(2048, 1024);
+    uLongf streamSize = compressBound(kSize);
+    unsigned char *stream = (unsigned char *)malloc(streamSize);
+    unsigned char *out = (unsigned char *)malloc(kSize);
+    double lodepngMs = 1e30, zlibMs = 1e30;
+    int run;
+
+    compress2(stream, &streamSize, data, kSize, 6);
+    for (run = 0; run < kRuns; run++) {
+        LodePNGDecompressSettings settings = lodepng_default_decompress_settings;
+        unsigned char *decoded = NULL;
+        size_t decodedSize = 0;
+        uLongf outSize = kSize;
+        double start = NowMs(), ms;
+        unsigned error = lodepng_zlib_decompress(&decoded, &decodedSize, stream, streamSize, &settings);
+        ms = NowMs() - start;
+        if (ms < lodepngMs) lodepngMs = ms;
+        if (error || decodedSize != kSize || memcmp(decoded, data, kSize)) printf("lodepng decoded it wrong\n");
+        free(decoded);
+
+        start = NowMs();
+        uncompress(out, &outSize, stream, streamSize);
+        ms = NowMs() - start;
+        if (ms < zlibMs) zlibMs = ms;
+    }
+    printf("inflate, 8 MB from %lu KB:  lodepng %6.1f ms (%5.0f MB/s)   zlib %6.1f ms (%5.0f MB/s)\n",
+           (unsigned long)streamSize / 1024, lodepngMs, kSize / 1048.576 / lodepngMs, zlibMs, kSize / 1048.576 / zlibMs);
+    free(out);
+    free(stream);
+    free(data);
+}
+
+static void BenchPng(unsigned width, unsigned height)
+{
+    unsigned char *image = MakeImage(width, height);
+    unsigned char *png = NULL;
+    size_t pngSize = 0;
+    double best = 1e30;
+    int run;
+
+    lodepng_encode32(&png, &pngSize, image, width, height);
+    for (run = 0; run < kRuns; run++) {
+        unsigned char *decoded = NULL;
+        unsigned w, h;
+        double start = NowMs(), ms;
+        unsigned error = lodepng_decode32(&decoded, &w, &h, png, pngSize);
+        ms = NowMs() - start;
+        if (ms < best) best = ms;
+        if (error || memcmp(decoded, image, (size_t)width * height * 4)) printf("lodepng decoded it wrong\n");
+        free(decoded);
+    }
+    printf("PNG decode, %ux%u RGBA from %lu KB: %6.1f ms\n", width, height, (unsigned long)pngSize / 1024, best);
+    free(png);
+    free(image);
+}
+
+int main(void)
+{
+    printf("inflate_bench: best of %d runs\n", kRuns);
+    BenchInflate();
+    BenchPng(1280, 720);
+    BenchPng(2048, 2048);
+    return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+/*
+lodepng's inflate, which decodes through lookup tables, against zlib. Every
+stream zlib and lodepng's encoder make from a corpus of data kinds must come
+back bit for bit. Corrupted and truncated streams must decode to the same
+bytes as zlib's or fail. Needs zlib on the host.
+*/
+
+#include "lodepng.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+enum { KIND_ZEROS, KIND_IMAGE, KIND_TEXT, KIND_RANDOM, KIND_RUNS, NUM_KINDS };
+
+static unsigned gSeed = 1;
+
+static unsigned Random(void)
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return gSeed >> 8;
+}
+
+static void MakeData(unsigned char *data, size_t size, int kind)
+{
+    static const char *words[] = { "drawImage", "(", "0", ",", "12.5", ";", "setTransform", "translate", " " };
+    size_t i = 0;
+    while (i < size) {
+        switch (kind) {
+        case KIND_ZEROS:
+            data[i++] = 0;
+            break;
+        case KIND_IMAGE: /*RGBA rows of a gradient with noise*/
+            data[i] = (unsigned char)((i % 4 == 3) ? 255 : (i % 1024) / 5 + (i / 4096) + Random() % 6);
+            i++;
+            break;
+        case KIND_TEXT: {
+            const char *word = words[Random() % (sizeof(words) / sizeof(words[0]))];
+            while (*word && i < size) data[i++] = (unsigned char)*word++;
+            break;
+        }
+        case KIND_RANDOM:
+            data[i++] = (unsigned char)Random();
+            break;
+        case KIND_RUNS: {
+            unsigned char value = (unsigned char)(Random() % 4);
+            size_t run = 1 + Random() % 300;
+            while (run-- && i < size) data[i++] = value;
+            break;
+        }
+        }
+    }
+}
+
+/*raw deflate with zlib; returns 0 if the stream doesn't end cleanly*/
+static int ZlibInflate(const unsigned char *in, size_t insize, unsigned char *out, size_t outcapacity, size_t *outsize)
+{
+    z_stream stream;
+    int result;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK) return 0;
+    stream.next_in = (unsigned char *)in;
+    stream.avail_in = (uInt)insize;
+    stream.next_out = out;
+    stream.avail_out = (uInt)outcapacity;
+    result = inflate(&stream, Z_FINISH);
+    *outsize = stream.total_out;
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+static int gStreams = 0;
+static int gDamaged = 0;
+static int gDisagreed = 0;
+
+/*stream is zlib wrapped; original is what it decodes to, or NULL if it is damaged*/
+static void CheckStream(const unsigned char *stream, size_t size, const unsigned char *original, size_t originalSize)
+{
+    LodePNGDecompressSettings settings = lodepng_default_decompress_settings;
+    unsigned char *out = NULL;
+    size_t outsize = 0;
+    unsigned error;
+
+    if (original) {
+        error = lodepng_zlib_decompress(&out, &outsize, stream, size, &settings);
+        CHECK(error == 0);
+        CHECK(outsize == originalSize);
+        CHECK(error != 0 || outsize != originalSize || outsize == 0 || memcmp(out, original, outsize) == 0);
+        gStreams++;
+    } else if (size > 2) {
+        /*the raw deflate data, so a flipped bit in the Adler-32 doesn't decide it*/
+        size_t capacity = 4 * 1024 * 1024;
+        unsigned char *expected = (unsigned char *)malloc(capacity);
+        size_t expectedSize = 0;
+        int ok = ZlibInflate(stream + 2, size - 2, expected, capacity, &expectedSize);
+        error = lodepng_inflate(&out, &outsize, stream + 2, size - 2, &settings);
+        if (ok && !error) {
+            CHECK(outsize == expectedSize && (outsize == 0 || memcmp(out, expected, outsize) == 0));
+        } else if (ok != !error) {
+            /*lodepng takes some incomplete code trees that zlib rejects*/
+            gDisagreed++;
+        }
+        free(expected);
+        gDamaged++;
+    }
+    free(out);
+}
+
+/*flipped bits and a cut off end*/
+static void CheckDamaged(const unsigned char *stream, size_t size)
+{
+    int variant;
+    unsigned char *copy;
+    if (size <= 2) return;
+    copy = (unsigned char *)malloc(size);
+    for (variant = 1; variant <= 4; variant++) {
+        int flip;
+        memcpy(copy, stream, size);
+        for (flip = 0; flip < variant; flip++) {
+            size_t at = 2 + Random() % (size - 2);
+            copy[at] ^= (unsigned char)(1 << (Random() % 8));
+        }
+        CheckStream(copy, size, NULL, 0);
+    }
+    CheckStream(stream, 2 + (size - 2) / 2, NULL, 0);
+    free(copy);
+}
+
+/*
+A dynamic block whose distance code lengths (0, 7, 4, 1, 7, 3, 1, 7) make an
+invalid tree: the 1 bit code of symbol 3 ends on a node that the 7 bit code of
+symbol 1 already goes through, so the code after it starts there and runs 11
+bits deep, past the longest length and the 9 root bits of the lookup table.
+The block is 40 literals, a length 3 distance 13 pair through that path, and
+40 more. lodepng decodes it without the tables by walking the tree, and must
+still give those bytes.
+*/
+static void CheckDeepTree(void)
+{
+    static const unsigned char stream[] = {
+        0x0d, 0xe7, 0x81, 0x0d, 0x03, 0x00, 0x0c, 0x03, 0x30, 0xd4, 0x26, 0x49, 0xfd,
+        0xd7, 0x24, 0x21, 0x66, 0xc4, 0x80, 0x32, 0x28, 0x83, 0x32, 0x28, 0x83, 0x32,
+        0x28, 0x83, 0x32, 0x28, 0x83, 0x32, 0x28, 0x17, 0x59, 0x80, 0x32, 0x28, 0x83,
+        0x32, 0x28, 0x83, 0x32, 0x28, 0x83, 0x32, 0x28, 0x83, 0x32, 0x28, 0x07
+    };
+    static const char expected[] = "ABCDABCDABCDABCDABCDABCDABCDABCDABCDABCD" "DAB"
+                                   "ABCDABCDABCDABCDABCDABCDABCDABCDABCDABCD";
+    LodePNGDecompressSettings settings = lodepng_default_decompress_settings;
+    unsigned char *out = NULL;
+    size_t outsize = 0;
+    unsigned error = lodepng_inflate(&out, &outsize, stream, sizeof(stream), &settings);
+    CHECK(error == 0);
+    CHECK(outsize == sizeof(expected) - 1 && memcmp(out, expected, outsize) == 0);
+    free(out);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 0, 1, 5, 300, 70000, 300000 };
+    static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+    size_t s;
+    int kind, level, strategy, btype;
+
+    for (kind = 0; kind < NUM_KINDS; kind++) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t size = sizes[s];
+            unsigned char *data = (unsigned char *)malloc(size + 1);
+            uLongf capacity = compressBound(size);
+            unsigned char *stream = (unsigned char *)malloc(capacity);
+            MakeData(data, size, kind);
+
+            for (level = 0; level <= 9; level++) {
+                for (strategy = 0; strategy < (int)(sizeof(strategies) / sizeof(strategies[0])); strategy++) {
+                    z_stream z;
+                    memset(&z, 0, sizeof(z));
+                    deflateInit2(&z, level, Z_DEFLATED, 15, 8, strategies[strategy]);
+                    z.next_in = data;
+                    z.avail_in = (uInt)size;
+                    z.next_out = stream;
+                    z.avail_out = (uInt)capacity;
+                    CHECK(deflate(&z, Z_FINISH) == Z_STREAM_END);
+                    CheckStream(stream, z.total_out, data, size);
+                    if (level == 6 || level == 1) CheckDamaged(stream, z.total_out);
+                    deflateEnd(&z);
+                }
+            }
+
+            /*lodepng's own stored, fixed and dynamic blocks*/
+            for (btype = 0; btype <= 2; btype++) {
+                LodePNGCompressSettings settings = lodepng_default_compress_settings;
+                unsigned char *out = NULL;
+                size_t outsize = 0;
+                settings.btype = (unsigned)btype;
+                CHECK(lodepng_zlib_compress(&out, &outsize, data, size, &settings) == 0);
+                CheckStream(out, outsize, data, size);
+                CheckDamaged(out, outsize);
+                free(out);
+            }
+
+            free(stream);
+            free(data);
+        }
+    }
+
+    CheckDeepTree();
+
+    printf("inflate_test: %d streams, %d damaged, %d of them decoded by only one of zlib and lodepng\n",
+           gStreams, gDamaged, gDisagreed);
+    return TestResult("inflate_test");
+}
@@ -0,0 +1,156 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+// Frame building and drawing for large numbers of quads.
+
+#include "Canvas.h"
+#include "commands.h"
+#include "test.h"
+
+static const int kFrames = 20;
+
+// Renders frames alternately, so none is skipped as a repeat; returns
+// the best time in ms
+static double TimeFrames( Canvas *canvas, const CommandWriter *frames )
+{
+    double best = 1e30;
+    for ( int i = 0; i < kFrames; i++ ) {
+        double start = NowMs();
+        canvas->RenderBinary( frames[i & 1].GetData(), frames[i & 1].GetSize() );
+        double ms = NowMs() - start;
+        if ( ms < best ) best = ms;
+    }
+    return best;
+}
+
+// 100000 quads from one texture: past the 16-bit index limit, so the
+// stream gets split
+static void BenchStress()
+{
+    static const int kQuads = 100000;
+    Canvas::Release();
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( 1280, 720 );
+    canvas->AddTexture( 1, 1000, 256, 256 );
+
+    CommandWriter frames[2];
+    for ( int f = 0; f < 2; f++ ) {
+        frames[f].SetTransform( 1, 0, 0, 1, (float)f, 0 );
+        for ( int i = 0; i < kQuads; i++ ) {
+            frames[f].DrawImage( 1, (float)(i % 8) * 32, 0, 32, 32,
+                                 (float)(i % 1250), (float)(i % 697), 32, 32 );
+        }
+    }
+
+    double ms = TimeFrames( canvas, frames );
+    gDrawCalls = 0;
+    gUploadBytes = 0;
+    canvas->RenderBinary( frames[0].GetData(), frames[0].GetSize() );
+    printf( "%d quads, one texture: %.2f ms/frame, %.1f ns/quad, %d draw calls, %ld KB uploaded\n",
+            kQuads, ms, ms * 1e6 / kQuads, gDrawCalls, gUploadBytes / 1024 );
+}
+
+// One of each class of transform DoPushQuad and QuadBatch handle
+static const struct {
+    const char *name;
+    float a, b, c, d, tx, ty;
+} transforms[] = {
+    { "identity",   1, 0, 0, 1, 0, 0 },
+    { "translate",  1, 0, 0, 1, 10.5f, 20 },
+    { "scale",      1.5f, 0, 0, 0.75f, 3, 4 },
+    { "affine",     0.8660254f, 0.5f, -0.5f, 0.8660254f, 640, 0 },
+};
+static const int kTransforms = sizeof(transforms) / sizeof(transforms[0]);
+
+// QuadBatch on its own: Add and Expand, in batches the size Canvas uses
+static void BenchBatch()
+{
+    static const int kQuads = 1024;     // Canvas::kMaxQuadBatch
+    static const int kRounds = 500;
+    Texture texture( 1, 1000, 256, 256 );
+    Color white;
+    white.SetWhite();
+    Vertex2 *vertices = new Vertex2[kQuads * Quad::kVertexCount];
+
+    for ( int t = 0; t < kTransforms; t++ ) {
+        Transform transform;
+        transform.a = transforms[t].a;
+        transform.b = transforms[t].b;
+        transform.c = transforms[t].c;
+        transform.d = transforms[t].d;
+        transform.tx = transforms[t].tx;
+        transform.ty = transforms[t].ty;
+        transform.Classify();
+
+        QuadBatch batch;
+        double best = 1e30;
+        for ( int run = 0; run < kFrames; run++ ) {
+            double start = NowMs();
+            for ( int round = 0; round < kRounds; round++ ) {
+                for ( int i = 0; i < kQuads; i++ ) {
+                    Clip clip = { (float)(i % 8) * 32, 0, 32, 32,
+                                  (float)(i % 600), (float)(i % 500), 32, 32, 1 };
+                    batch.Add( transform, clip, &texture, white, i * Quad::kVertexCount );
+                }
+                batch.Expand( vertices );
+            }
+            double ms = NowMs() - start;
+            if ( ms < best ) best = ms;
+        }
+        printf( "QuadBatch, %-10s %.1f ns/quad\n", transforms[t].name,
+                best * 1e6 / ((double)kQuads * kRounds) );
+    }
+    delete [] vertices;
+}
+
+// Whole frames of 20000 quads under each transform: parsing, batching
+// and upload
+static void BenchTransforms()
+{
+    static const int kQuads = 20000;
+
+    Canvas::Release();
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( 1280, 720 );
+    canvas->AddTexture( 1, 1000, 256, 256 );
+
+    for ( int t = 0; t < kTransforms; t++ ) {
+        // The frames differ in their first quad only, so the identity
+        // transform is kept for both
+        CommandWriter frames[2];
+        for ( int f = 0; f < 2; f++ ) {
+            frames[f].SetTransform( transforms[t].a, transforms[t].b, transforms[t].c,
+                                    transforms[t].d, transforms[t].tx, transforms[t].ty );
+            for ( int i = 0; i < kQuads; i++ ) {
+                float x = (float)(i % 600) + (i == 0 ? (float)f : 0.0f);
+                frames[f].DrawImage( 1, (float)(i % 8) * 32, 0, 32, 32, x, (float)(i % 500), 32, 32 );
+            }
+        }
+        double ms = TimeFrames( canvas, frames );
+        printf( "%d quad frame, %-10s %.2f ms/frame, %.1f ns/quad\n",
+                kQuads, transforms[t].name, ms, ms * 1e6 / kQuads );
+    }
+}
+
+int main()
+{
+    printf( "quad_bench: best of %d frames\n", kFrames );
+    BenchStress();
+    BenchBatch();
+    BenchTransforms();
+    Canvas::Release();
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Helpers shared by the host tests and benchmarks. See Makefile.
+
+#ifndef _Included_test
+#define _Included_test
+
+#include <stdio.h>
+#include <time.h>
+
+static int gFailures = 0;
+
+// Records a failure and carries on, so one run reports every mismatch
+#define CHECK( x ) { if (!(x)) { ++gFailures; fprintf( stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #x ); }}
+
+// Prints the result line; returns the process exit code
+static inline int TestResult( const char *name )
+{
+    printf( "%s: %s\n", name, gFailures ? "FAILED" : "passed" );
+    return gFailures ? 1 : 0;
+}
+
+static inline double NowMs( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Counted by gl_stubs.cpp
+extern int gDrawCalls;
+extern long gUploadBytes;
+extern int gTexturesDeleted;
+// RGBA, the size of the stub viewport, bottom row first; NULL for a fixed
+// pattern
+extern const unsigned char *gFramebuffer;
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _Included_test
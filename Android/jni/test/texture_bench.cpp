@@ -0,0 +1,73 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+// Cost of registering textures and of looking them up for drawImage, as
+// the number of textures grows. IDs below Canvas::kTextureTableSize go
+// through the ID table; large IDs fall back to the linear scan, which is
+// what every lookup used to be.
+
+#include "Canvas.h"
+#include "commands.h"
+#include "test.h"
+
+static const int kDraws = 20000;
+static const int kFrames = 20;
+
+static void Bench( int count, int firstID, const char *path )
+{
+    Canvas::Release();
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( 1280, 720 );
+
+    double start = NowMs();
+    for ( int i = 0; i < count; i++ ) {
+        canvas->AddTexture( firstID + i, 1000 + i, 64, 64 );
+    }
+    double registerMs = NowMs() - start;
+
+    // Two frames that differ, so neither is skipped as a repeat. IDs are
+    // spread over all the textures.
+    CommandWriter frames[2];
+    for ( int f = 0; f < 2; f++ ) {
+        frames[f].SetTransform( 1, 0, 0, 1, (float)f, 0 );
+        for ( int i = 0; i < kDraws; i++ ) {
+            int id = firstID + (int)((i * 7919u) % count);
+            frames[f].DrawImage( id, 0, 0, 64, 64, (float)(i % 1200), (float)(i % 700), 64, 64 );
+        }
+    }
+
+    double best = 1e30;
+    for ( int i = 0; i < kFrames; i++ ) {
+        start = NowMs();
+        canvas->RenderBinary( frames[i & 1].GetData(), frames[i & 1].GetSize() );
+        double ms = NowMs() - start;
+        if ( ms < best ) best = ms;
+    }
+
+    printf( "%5d textures, %-6s register %7.1f ns/texture   frame %6.2f ms, %6.1f ns/drawImage\n",
+            count, path, registerMs * 1e6 / count, best, best * 1e6 / kDraws );
+}
+
+int main()
+{
+    printf( "texture_bench: %d drawImage calls per frame, best of %d frames\n", kDraws, kFrames );
+    static const int counts[] = { 1, 16, 256, 1024, 4000 };
+    for ( size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++ ) {
+        Bench( counts[i], 1, "table" );
+        Bench( counts[i], 100000, "scan" );
+    }
+    Canvas::Release();
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+// Texture bookkeeping: adding under an ID that is already taken replaces
+// the old texture instead of keeping both.
+
+#include "Canvas.h"
+#include "commands.h"
+#include "test.h"
+extern "C" {
+#include "lodepng.h"
+}
+
+int main()
+{
+    Canvas *canvas = Canvas::GetCanvas();
+    canvas->OnSurfaceChanged( 1280, 720 );
+
+    // As when a reload and a decode that was in flight both land
+    canvas->AddTexture( 5, 100, 64, 64 );
+    canvas->AddTexture( 5, 101, 64, 64 );
+    CHECK( gTexturesDeleted == 1 );
+
+    // Only the newer one is left to remove
+    canvas->RemoveTexture( 5 );
+    CHECK( gTexturesDeleted == 2 );
+    canvas->RemoveTexture( 5 );
+    CHECK( gTexturesDeleted == 2 );
+
+    // The same outside the ID table
+    canvas->AddTexture( 100000, 102, 64, 64 );
+    canvas->AddTexture( 100000, 103, 64, 64 );
+    canvas->RemoveTexture( 100000 );
+    canvas->RemoveTexture( 100000 );
+    CHECK( gTexturesDeleted == 4 );
+
+    // Replacing the only texture on an atlas page keeps the page
+    canvas->SetTextureAtlas( true );
+    unsigned char pixels[16 * 16 * 4] = { 0 };
+    unsigned char *png = NULL;
+    size_t pngSize = 0;
+    CHECK( lodepng_encode32( &png, &pngSize, pixels, 16, 16 ) == 0 );
+    unsigned int width, height;
+    int deleted = gTexturesDeleted;
+    CHECK( canvas->AddPngTexture( png, (long)pngSize, 6, &width, &height ) );
+    CHECK( canvas->AddPngTexture( png, (long)pngSize, 6, &width, &height ) );
+    CHECK( gTexturesDeleted == deleted );
+    canvas->RemoveTexture( 6 );
+    CHECK( gTexturesDeleted == deleted + 1 );
+    free( png );
+
+    // Drawing the replaced ID still works
+    canvas->AddTexture( 7, 104, 64, 64 );
+    canvas->AddTexture( 7, 105, 64, 64 );
+    CommandWriter frame;
+    frame.DrawImage( 7, 0, 0, 64, 64, 10, 10, 64, 64 );
+    gDrawCalls = 0;
+    canvas->RenderBinary( frame.GetData(), frame.GetSize() );
+    CHECK( gDrawCalls == 1 );
+
+    Canvas::Release();
+    return TestResult( "texture_test" );
+}
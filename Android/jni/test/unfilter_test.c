@@ -0,0 +1,163 @@
+/*
+ Copyright 2013 Adobe Systems Inc.;
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+/*
+The SSE2 or NEON unfiltering in lodepng_unfilter.c against the scalar code it
+replaces, copied here from lodepng.c's unfilterScanline: every filter type at
+3 and 4 bytes per pixel, on random, smooth and saturated scanlines of many
+lengths, in place and not, must give the same bytes.
+*/
+
+#include "lodepng_unfilter.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { DATA_RANDOM, DATA_SMOOTH, DATA_SATURATED, NUM_DATA };
+
+/*bytes past the end of recon, which the unfiltering must not touch*/
+static const size_t kGuard = 64;
+static const unsigned char kGuardByte = 0xa5;
+
+static unsigned gSeed = 1;
+
+static unsigned Random(void)
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return gSeed >> 8;
+}
+
+static void MakeScanline(unsigned char *line, size_t length, int kind)
+{
+    size_t i;
+    for (i = 0; i < length; i++) {
+        switch (kind) {
+        case DATA_RANDOM: line[i] = (unsigned char)Random(); break;
+        case DATA_SMOOTH: line[i] = (unsigned char)(i / 7 + Random() % 3); break;
+        case DATA_SATURATED: line[i] = (Random() & 1) ? 255 : 0; break;
+        }
+    }
+}
+
+static unsigned char PaethPredictor(short a, short b, short c)
+{
+    short pa = abs(b - c);
+    short pb = abs(a - c);
+    short pc = abs(a + b - c - c);
+
+    if (pc < pa && pc < pb) return (unsigned char)c;
+    else if (pb < pa) return (unsigned char)b;
+    else return (unsigned char)a;
+}
+
+/*unfilterScanline with a previous scanline, as lodepng.c has it*/
+static void ScalarUnfilter(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon,
+                           size_t bytewidth, unsigned char filterType, size_t length)
+{
+    size_t i;
+    switch (filterType) {
+    case 0:
+        for (i = 0; i < length; i++) recon[i] = scanline[i];
+        break;
+    case 1:
+        for (i = 0; i < bytewidth; i++) recon[i] = scanline[i];
+        for (i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+        break;
+    case 2:
+        for (i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
+        break;
+    case 3:
+        for (i = 0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
+        for (i = bytewidth; i < length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
+        break;
+    case 4:
+        for (i = 0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i];
+        for (i = bytewidth; i < length; i++)
+            recon[i] = scanline[i] + PaethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
+        break;
+    }
+}
+
+/*returns 1 if the SIMD code took the scanline*/
+static int CheckScanline(size_t bytewidth, unsigned char filterType, size_t pixels, int kind, int inPlace)
+{
+    size_t length = bytewidth * pixels;
+    unsigned char *scanline = (unsigned char *)malloc(length + kGuard);
+    unsigned char *precon = (unsigned char *)malloc(length);
+    unsigned char *expected = (unsigned char *)malloc(length);
+    unsigned char *recon = (unsigned char *)malloc(length + kGuard);
+    unsigned char *in;
+    size_t i;
+    int handled;
+
+    MakeScanline(scanline, length, kind);
+    MakeScanline(precon, length, kind);
+    ScalarUnfilter(expected, scanline, precon, bytewidth, filterType, length);
+
+    memcpy(recon, scanline, length);
+    memset(recon + length, kGuardByte, kGuard);
+    in = inPlace ? recon : scanline;
+    handled = lodepng_unfilter_simd(recon, in, precon, bytewidth, filterType, length);
+    if (handled) {
+        if (memcmp(recon, expected, length)) {
+            printf("filter %u, %u bytes per pixel, %u pixels, data %d%s: wrong bytes\n", filterType,
+                   (unsigned)bytewidth, (unsigned)pixels, kind, inPlace ? ", in place" : "");
+            CHECK(0);
+        }
+        for (i = length; i < length + kGuard; i++) CHECK(recon[i] == kGuardByte);
+    }
+
+    free(recon);
+    free(expected);
+    free(precon);
+    free(scanline);
+    return handled;
+}
+
+int main(void)
+{
+    /*around the 16 byte vectors and the 1280 pixel screen width*/
+    static const size_t pixelCounts[] = { 1, 2, 3, 4, 5, 6, 7, 8, 15, 16, 17, 31, 33, 100, 1279, 1280, 1281, 4096 };
+    size_t bytewidth, p;
+    unsigned filterType;
+    int kind, inPlace, handled = 0, vectorizable = 0;
+
+    for (bytewidth = 3; bytewidth <= 4; bytewidth++)
+        for (filterType = 0; filterType <= 4; filterType++)
+            for (p = 0; p < sizeof(pixelCounts) / sizeof(pixelCounts[0]); p++)
+                for (kind = 0; kind < NUM_DATA; kind++)
+                    for (inPlace = 0; inPlace <= 1; inPlace++) {
+                        handled += CheckScanline(bytewidth, (unsigned char)filterType, pixelCounts[p], kind, inPlace);
+                        if (filterType != 0) vectorizable++;
+                    }
+
+    /*what the scalar code has to do: no previous scanline, other pixel sizes, bad filter types; filter 0 is a copy*/
+    {
+        unsigned char scanline[48] = { 0 }, precon[48] = { 0 }, recon[48];
+        CHECK(!lodepng_unfilter_simd(recon, scanline, NULL, 4, 4, 48));
+        CHECK(!lodepng_unfilter_simd(recon, scanline, precon, 2, 4, 48));
+        CHECK(!lodepng_unfilter_simd(recon, scanline, precon, 6, 4, 48));
+        CHECK(!lodepng_unfilter_simd(recon, scanline, precon, 4, 5, 48));
+        CHECK(!lodepng_unfilter_simd(recon, scanline, precon, 4, 0, 48));
+    }
+
+    printf("unfilter_test: %d of %d filter 1-4 scanlines unfiltered with SIMD\n", handled, vectorizable);
+#if defined(__SSE2__) || defined(LODEPNG_UNFILTER_NEON)
+    /*else nothing above was compared*/
+    CHECK(handled == vectorizable);
+#endif
+    return TestResult("unfilter_test");
+}
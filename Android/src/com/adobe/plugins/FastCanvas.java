@@ -24,6 +24,8 @@ import org.json.JSONArray;
 import org.json.JSONException;
 
 import java.io.File;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.LinkedList;
 import java.util.concurrent.BlockingQueue;
 import java.util.concurrent.LinkedBlockingQueue;
@@ -43,6 +45,32 @@ public class FastCanvas extends CordovaPlugin {
 	private FastCanvasView mCanvasView;
     
 	private static FastCanvas theCanvas = null;
+
+	// Direct buffers for binary render commands, handed back by the renderer
+	// once drawn. Used from both the WebView and GL threads.
+	private static final LinkedList<ByteBuffer> theDrawBuffers = new LinkedList<ByteBuffer>();
+	private static final int MAX_FREE_DRAW_BUFFERS = 3;
+	private static final int MIN_DRAW_BUFFER_SIZE = 4096;
+	private static final byte[] BASE64_VALUES = new byte[128];
+	static {
+		java.util.Arrays.fill(BASE64_VALUES, (byte)-1);
+		String alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		for (int i = 0; i < alphabet.length(); i++) {
+			BASE64_VALUES[alphabet.charAt(i)] = (byte)i;
+		}
+	}
+
+	// PNG compression presets for capture, fastest first. The numbers match
+	// CaptureParams::Compression in the native code.
+	public static final int COMPRESS_STORE = 0;
+	public static final int COMPRESS_FAST = 1;
+	public static final int COMPRESS_DEFAULT = 2;
+	public static final int COMPRESS_BEST = 3;
+
+	// Where a capture goes. The numbers match CaptureParams::Output.
+	public static final int OUTPUT_FILE = 0;
+	public static final int OUTPUT_PNG = 1; // the PNG bytes, as an ArrayBuffer
+	public static final int OUTPUT_RGBA = 2; // width, height and pixels, as an ArrayBuffer
 	
 	@Override
     public void initialize(CordovaInterface cordova, CordovaWebView webView) {
@@ -108,6 +136,13 @@ public class FastCanvas extends CordovaPlugin {
 			mMessageQueue.add(m);
 			return true;
 				
+		} else if (action.equals("renderBinary")) {
+			// ArrayBuffer arguments arrive base64 encoded
+			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.RENDER);
+			m.drawBuffer = decodeDrawBuffer(args.getString(0));
+			mMessageQueue.add(m);
+			return true;
+				
 		} else if (action.equals("setOrtho")) {
 			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.SET_ORTHO);
 			int width = args.getInt(0);
@@ -118,9 +153,33 @@ public class FastCanvas extends CordovaPlugin {
 			mMessageQueue.add(m);
 			return true;
 				
+		} else if (action.equals("setTextureAtlas")) {
+			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.SET_TEXTURE_ATLAS);
+			m.enabled = args.getBoolean(0);
+			Log.i("CANVAS", "FastCanvas queueing setTextureAtlas " + m.enabled);
+			mMessageQueue.add(m);
+			return true;
+				
+		} else if (action.equals("setViewportCulling")) {
+			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.SET_VIEWPORT_CULLING);
+			m.enabled = args.getBoolean(0);
+			Log.i("CANVAS", "FastCanvas queueing setViewportCulling " + m.enabled);
+			mMessageQueue.add(m);
+			return true;
+				
+		} else if (action.equals("setBatchReordering")) {
+			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.SET_BATCH_REORDERING);
+			m.enabled = args.getBoolean(0);
+			Log.i("CANVAS", "FastCanvas queueing setBatchReordering " + m.enabled);
+			mMessageQueue.add(m);
+			return true;
+				
 		} else if(action.equals("capture")) {
+			int output = captureOutput(args.optString(6, "file"));
+			String fileLocation = "";
+			if (output == OUTPUT_FILE) {
                 //set the root path to /mnt/sdcard/
-                String fileLocation = Environment.getExternalStorageDirectory() +args.getString(4);
+                fileLocation = Environment.getExternalStorageDirectory() +args.getString(4);
                 String justPath = fileLocation.substring(0, fileLocation.lastIndexOf('/'));
                 File directory = new File(justPath);
                 if(!directory.isDirectory()) {
@@ -132,6 +191,7 @@ public class FastCanvas extends CordovaPlugin {
                         return true;
                     }
                 }
+			}
                 
 			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.CAPTURE);
 			m.x = args.optInt(0, 0);
@@ -139,6 +199,10 @@ public class FastCanvas extends CordovaPlugin {
 			m.width = args.optInt(2,-1);
 			m.height = args.optInt(3,-1);
                 m.url = fileLocation;
+			m.compression = compressionPreset(args.optString(5, "default"));
+			m.output = output;
+			m.thumbWidth = args.optInt(7, 0);
+			m.thumbHeight = args.optInt(8, 0);
 			
 			Log.i("CANVAS","FastCanvas queueing capture");
 			if(callbackContext != null)
@@ -190,15 +254,24 @@ public class FastCanvas extends CordovaPlugin {
 		}); // end runnable
 	} // initView
 	
-	public static void executeCallback(String callbackID, boolean isError, String result) {
+	// data, when not null, is the result instead of the string
+	public static void executeCallback(String callbackID, boolean isError, String result, byte[] data) {
 		if (theCanvas == null) {
 			return;
 		}
 		
+		// Texture loads finish in the renderer, which answers the JS callback itself
+		FastCanvasRenderer renderer = theCanvas.mCanvasView != null ? theCanvas.mCanvasView.getRenderer() : null;
+		if (renderer != null && renderer.completeTextureLoad(callbackID, isError, result)) {
+			return;
+		}
+		
 		PluginResult res;
 		
 		if(isError) 
 			 res = new PluginResult(PluginResult.Status.ERROR,result);
+		else if(data != null)
+			 res = new PluginResult(PluginResult.Status.OK,data);
 		else
 			 res = new PluginResult(PluginResult.Status.OK,result);
 		
@@ -234,6 +307,28 @@ public class FastCanvas extends CordovaPlugin {
 		}
 	}
 	
+	// Unknown names get the default, so old scripts keep working.
+	private static int compressionPreset(String name) {
+		if (name.equals("store")) {
+			return COMPRESS_STORE;
+		} else if (name.equals("fast")) {
+			return COMPRESS_FAST;
+		} else if (name.equals("best")) {
+			return COMPRESS_BEST;
+		}
+		return COMPRESS_DEFAULT;
+	}
+
+	// Unknown names write a file, as before there was a choice.
+	private static int captureOutput(String name) {
+		if (name.equals("png")) {
+			return OUTPUT_PNG;
+		} else if (name.equals("rgba")) {
+			return OUTPUT_RGBA;
+		}
+		return OUTPUT_FILE;
+	}
+
 	public static Activity getActivity() {
 		Activity theActivity = null;
 		if (theCanvas != null) {
@@ -242,6 +337,71 @@ public class FastCanvas extends CordovaPlugin {
 		return theActivity;
 	}
 	
+	// Decodes base64 straight into a pooled direct buffer, rather than into a
+	// byte array that then gets copied into a new direct buffer every frame
+	private static ByteBuffer decodeDrawBuffer(String text) {
+		int length = text.length();
+		while (length > 0 && text.charAt(length - 1) == '=') {
+			length--;
+		}
+		
+		ByteBuffer buffer = obtainDrawBuffer(length * 3 / 4);
+		int bits = 0;
+		int bitCount = 0;
+		for (int i = 0; i < length; i++) {
+			char c = text.charAt(i);
+			int value = c < 128 ? BASE64_VALUES[c] : -1;
+			if (value < 0) {
+				continue; // line breaks
+			}
+			bits = (bits << 6) | value;
+			bitCount += 6;
+			if (bitCount >= 8) {
+				bitCount -= 8;
+				buffer.put((byte)(bits >> bitCount));
+			}
+		}
+		buffer.flip();
+		return buffer;
+	}
+	
+	private static ByteBuffer obtainDrawBuffer(int size) {
+		synchronized (theDrawBuffers) {
+			for (int i = 0; i < theDrawBuffers.size(); i++) {
+				if (theDrawBuffers.get(i).capacity() >= size) {
+					ByteBuffer buffer = theDrawBuffers.remove(i);
+					buffer.clear();
+					return buffer;
+				}
+			}
+			// Nothing big enough. Drop the smallest so the pool only grows
+			// towards the largest frame seen.
+			if (!theDrawBuffers.isEmpty()) {
+				theDrawBuffers.removeFirst();
+			}
+		}
+		
+		int capacity = MIN_DRAW_BUFFER_SIZE;
+		while (capacity < size) {
+			capacity *= 2;
+		}
+		return ByteBuffer.allocateDirect(capacity).order(ByteOrder.LITTLE_ENDIAN);
+	}
+	
+	// Called by the renderer when it is done with a RENDER message's buffer
+	public static void recycleDrawBuffer(ByteBuffer buffer) {
+		synchronized (theDrawBuffers) {
+			if (theDrawBuffers.size() < MAX_FREE_DRAW_BUFFERS) {
+				// Keep sorted by capacity, smallest first
+				int i = 0;
+				while (i < theDrawBuffers.size() && theDrawBuffers.get(i).capacity() < buffer.capacity()) {
+					i++;
+				}
+				theDrawBuffers.add(i, buffer);
+			}
+		}
+	}
+	
 	public static boolean copyMessageQueue(LinkedList<FastCanvasMessage> targetQueue) {
 		if (theCanvas == null || theCanvas.mMessageQueue == null) {
 			return false;
@@ -16,16 +16,23 @@
 
 package com.adobe.plugins;
 
+import java.nio.ByteBuffer;
+
 public class FastCanvasJNI {
 	// Native methods
 	public static native void setBackgroundColor(int red, int green, int blue);
 	public static native void setOrtho(int width, int height);
 	public static native void addTexture(int id, int glID, int width, int height); // id's must be from 0 to numTextures-1
 	public static native boolean addPngTexture(Object mgr, String path, int id, FastCanvasTextureDimension dim); // id's must be from 0 to numTextures-1
+	public static native boolean queuePngTexture(Object mgr, String path, int id, String callbackID); // decodes on a worker thread, the result comes back through FastCanvas.executeCallback
+	public static native void setTextureAtlas(boolean enabled); // pack small PNGs loaded afterwards into shared textures
+	public static native void setViewportCulling(boolean enabled); // drop draws outside the ortho rectangle
+	public static native void setBatchReordering(boolean enabled); // batch non-overlapping draws by texture
 	public static native void removeTexture(int id); // id must have been passed to addTexture in the past
     public static native void render(String renderCommands);
+    public static native void renderBinary(ByteBuffer renderCommands, int length); // renderCommands must be a direct buffer
 	public static native void surfaceChanged( int width, int height );
-	public static native void captureGLLayer(String callbackID, int x, int y, int width, int height, String fileName); //captures the current contents of the GL layer and writes to a temporary file
+	public static native void captureGLLayer(String callbackID, int x, int y, int width, int height, String fileName, int compression, int output, int thumbWidth, int thumbHeight); //captures the current contents of the GL layer, scaled down to thumbWidth x thumbHeight if set, and writes to a temporary file, or returns it through executeCallback
 	public static native void contextLost(); // Deletes native memory associated with lost GL context
 	public static native void release(); // Deletes native canvas
 	
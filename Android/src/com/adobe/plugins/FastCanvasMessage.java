@@ -16,6 +16,8 @@
 
 package com.adobe.plugins;
 
+import java.nio.ByteBuffer;
+
 import org.apache.cordova.api.CallbackContext;
 
 
@@ -28,7 +30,10 @@ public class FastCanvasMessage {
 		RENDER,
 		SET_ORTHO,
 		CAPTURE,
-		SET_BACKGROUND
+		SET_BACKGROUND,
+		SET_TEXTURE_ATLAS,
+		SET_VIEWPORT_CULLING,
+		SET_BATCH_REORDERING
 	}
 	
 	public FastCanvasMessage( Type t ) {
@@ -41,10 +46,16 @@ public class FastCanvasMessage {
 	public int textureID;
 	public CallbackContext callbackContext;
 	public String drawCommands;
+	public ByteBuffer drawBuffer; // binary render commands, direct buffer
+	public boolean enabled;
 	
 	//capture support members
 	public int x;
 	public int y;
 	public int width;
 	public int height;
+	public int compression; // FastCanvas.COMPRESS_*
+	public int output; // FastCanvas.OUTPUT_*
+	public int thumbWidth; // 0 for the captured size
+	public int thumbHeight;
 }
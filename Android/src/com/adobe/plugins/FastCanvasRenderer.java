@@ -16,10 +16,14 @@
 
 package com.adobe.plugins;
 
+import java.io.FileInputStream;
 import java.io.IOException;
 import java.io.InputStream;
+import java.nio.ByteBuffer;
 import java.nio.IntBuffer;
 import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.HashSet;
 import java.util.Iterator;
 import java.util.LinkedList;
 import java.util.List;
@@ -51,9 +55,11 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 
 	// ==========================================================================
 	private String mRenderCommands;
+	private ByteBuffer mRenderBuffer;
 	private LinkedList<FastCanvasMessage> mLocalQueue = new LinkedList<FastCanvasMessage>(); 
 	private List<FastCanvasTexture> mTextures = new ArrayList<FastCanvasTexture>();
 	private List<FastCanvasMessage> mCaptureQueue = new ArrayList<FastCanvasMessage>();
+	private HashMap<String, FastCanvasMessage> mPendingLoads = new HashMap<String, FastCanvasMessage>(); // by callback ID
 	private FastCanvasView mView;
 	
 	// Frame limiter
@@ -69,6 +75,7 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 		}
 		
 		mRenderCommands = "";
+		mRenderBuffer = null;
 		FastCanvasMessage m;
 
 		while ( mLocalQueue.size() > 0 ) {
@@ -85,41 +92,25 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 					}
 					
 					// Load and track the texture
-					String path = "www/" + m.url;
-					boolean success = false;
-					FastCanvasTextureDimension dim = new FastCanvasTextureDimension();
+					String path = texturePath(m.url);
 					
 					// See the following for why PNG files with premultiplied alpha and GLUtils don't get along
 					// http://stackoverflow.com/questions/3921685/issues-with-glutils-teximage2d-and-alpha-in-textures
 					if (path.toLowerCase(Locale.US).endsWith(".png")) {
-						success = FastCanvasJNI.addPngTexture(theActivity.getAssets(), path, m.textureID, dim);
-						if (success == false) {
-							Log.i("CANVAS", "CanvasRenderer loadTexture failed to load PNG in native code, falling back to GLUtils.");
+						// Decoded on a native worker thread, completeTextureLoad finishes the load
+						String callbackID = m.callbackContext.getCallbackId();
+						if (FastCanvasJNI.queuePngTexture(theActivity.getAssets(), path, m.textureID, callbackID)) {
+							mPendingLoads.put(callbackID, m);
+							mTextures.add(new FastCanvasTexture(m.url, m.textureID));
+							continue;
 						}
+						Log.i("CANVAS", "CanvasRenderer loadTexture failed to queue PNG in native code, falling back to GLUtils.");
 					} 
 
-					if (success == false) {
-						try {
-							InputStream instream = theActivity.getAssets().open(path);
-							final Bitmap bmp = BitmapFactory.decodeStream(instream);
-							loadTexture(bmp, m.textureID);
-							dim.width = bmp.getWidth();
-							dim.height = bmp.getHeight();
-							success = true;
-						} catch (IOException e) {
-							Log.i("CANVAS", "CanvasRenderer loadTexture error=", e);
-							m.callbackContext.error( e.getMessage() );
-						}
-					}
-					
-					if (success == true) {
-						FastCanvasTexture t = new FastCanvasTexture (m.url, m.textureID);
-						mTextures.add(t);
-
-						JSONArray args = new JSONArray();
-						args.put(dim.width);
-						args.put(dim.height);
-						m.callbackContext.success(args);
+					FastCanvasTextureDimension dim = new FastCanvasTextureDimension();
+					if (loadBitmapTexture(m, dim)) {
+						mTextures.add(new FastCanvasTexture(m.url, m.textureID));
+						loadSucceeded(m, dim);
 					}
 				}
 			} else if (m.type == FastCanvasMessage.Type.UNLOAD ) {
@@ -135,7 +126,7 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 				Activity theActivity = FastCanvas.getActivity();
 				if ( theActivity != null ) {
 					// Reload the texture
-					String path = "www/" + m.url;
+					String path = texturePath(m.url);
 					boolean success = false;
 					
 					if (path.toLowerCase(Locale.US).endsWith(".png")) {
@@ -144,7 +135,7 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 
 					if (success == false) {
 						try {
-							InputStream instream = theActivity.getAssets().open(path);
+							InputStream instream = openTexture(theActivity, path);
 							final Bitmap bmp = BitmapFactory.decodeStream(instream);
 							loadTexture(bmp, m.textureID);
 						} catch (IOException e) {
@@ -153,16 +144,37 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 					}
 				}
 			} else if (m.type == FastCanvasMessage.Type.RENDER ) {
-				mRenderCommands = m.drawCommands;
+				if (mRenderBuffer != null) {
+					// Superseded before it was drawn
+					FastCanvas.recycleDrawBuffer(mRenderBuffer);
+				}
+				if (m.drawBuffer != null) {
+					mRenderCommands = "";
+					mRenderBuffer = m.drawBuffer;
+				} else {
+					mRenderCommands = m.drawCommands;
+					mRenderBuffer = null;
+				}
 				while(!mCaptureQueue.isEmpty()) {
 					FastCanvasMessage captureMessage = mCaptureQueue.get(0);
 					FastCanvasJNI.captureGLLayer(captureMessage.callbackContext.getCallbackId(),captureMessage.x,
-							captureMessage.y, captureMessage.width, captureMessage.height, captureMessage.url);
+							captureMessage.y, captureMessage.width, captureMessage.height, captureMessage.url,
+							captureMessage.compression, captureMessage.output,
+							captureMessage.thumbWidth, captureMessage.thumbHeight);
 					mCaptureQueue.remove(0);
 				}
 			} else if (m.type == FastCanvasMessage.Type.SET_ORTHO) {
 				Log.i("CANVAS", "CanvasRenderer setOrtho width=" + m.width + ", height=" + m.height);
 				FastCanvasJNI.setOrtho(m.width, m.height);
+			} else if (m.type == FastCanvasMessage.Type.SET_TEXTURE_ATLAS) {
+				Log.i("CANVAS", "CanvasRenderer setTextureAtlas " + m.enabled);
+				FastCanvasJNI.setTextureAtlas(m.enabled);
+			} else if (m.type == FastCanvasMessage.Type.SET_VIEWPORT_CULLING) {
+				Log.i("CANVAS", "CanvasRenderer setViewportCulling " + m.enabled);
+				FastCanvasJNI.setViewportCulling(m.enabled);
+			} else if (m.type == FastCanvasMessage.Type.SET_BATCH_REORDERING) {
+				Log.i("CANVAS", "CanvasRenderer setBatchReordering " + m.enabled);
+				FastCanvasJNI.setBatchReordering(m.enabled);
 			} else if(m.type == FastCanvasMessage.Type.CAPTURE) {
 				Log.i("CANVAS", "CanvasRenderer capture");
 				mCaptureQueue.add(m);
@@ -246,7 +258,13 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 			flushQueue();
 			debugTexture();
 		
-			FastCanvasJNI.render(mRenderCommands);
+			if (mRenderBuffer != null) {
+				FastCanvasJNI.renderBinary(mRenderBuffer, mRenderBuffer.limit());
+				FastCanvas.recycleDrawBuffer(mRenderBuffer);
+				mRenderBuffer = null;
+			} else {
+				FastCanvasJNI.render(mRenderCommands);
+			}
 			checkError();
 		}
 	}
@@ -327,8 +345,94 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 		Log.i("CANVAS", "CanvasRenderer Leaving loadtexture " + id);
 	}
 
+	// ==========================================================================
+	// file:// URLs are loose files, like images the app downloaded; anything
+	// else is an asset under www/. Native code maps either without copying.
+	private static String texturePath(String url) {
+		if (url.startsWith("file://")) {
+			return url.substring("file://".length());
+		}
+		return "www/" + url;
+	}
+
+	private static InputStream openTexture(Activity theActivity, String path) throws IOException {
+		if (path.startsWith("/")) {
+			return new FileInputStream(path);
+		}
+		return theActivity.getAssets().open(path);
+	}
+
+	// ==========================================================================
+	// Loads the texture for m with BitmapFactory, reporting any error to JS.
+	private boolean loadBitmapTexture(FastCanvasMessage m, FastCanvasTextureDimension dim) {
+		Activity theActivity = FastCanvas.getActivity();
+		if ( theActivity == null ) {
+			return false;
+		}
+		try {
+			InputStream instream = openTexture(theActivity, texturePath(m.url));
+			final Bitmap bmp = BitmapFactory.decodeStream(instream);
+			loadTexture(bmp, m.textureID);
+			dim.width = bmp.getWidth();
+			dim.height = bmp.getHeight();
+			return true;
+		} catch (IOException e) {
+			Log.i("CANVAS", "CanvasRenderer loadTexture error=", e);
+			m.callbackContext.error( e.getMessage() );
+			return false;
+		}
+	}
+
+	// ==========================================================================
+	private void loadSucceeded(FastCanvasMessage m, FastCanvasTextureDimension dim) {
+		JSONArray args = new JSONArray();
+		args.put(dim.width);
+		args.put(dim.height);
+		m.callbackContext.success(args);
+	}
+
+	// ==========================================================================
+	// Called on the GL thread with the result of a queuePngTexture, which is
+	// "width,height" or the decoder's error. Returns false for callbacks that
+	// aren't texture loads.
+	public boolean completeTextureLoad(String callbackID, boolean isError, String result) {
+		FastCanvasMessage m = mPendingLoads.remove(callbackID);
+		if (m == null) {
+			return false;
+		}
+
+		FastCanvasTextureDimension dim = new FastCanvasTextureDimension();
+		if (isError) {
+			Log.i("CANVAS", "CanvasRenderer loadTexture failed to decode PNG in native code (" + result + "), falling back to GLUtils.");
+			if (!loadBitmapTexture(m, dim)) {
+				for (int i = 0; i < mTextures.size(); i++) {
+					if (mTextures.get(i).id == m.textureID) {
+						mTextures.remove(i);
+						break;
+					}
+				}
+				return true;
+			}
+		} else {
+			String[] size = result.split(",");
+			dim.width = Integer.parseInt(size[0]);
+			dim.height = Integer.parseInt(size[1]);
+		}
+		loadSucceeded(m, dim);
+		return true;
+	}
+
 	// ==========================================================================
 	public void unloadTexture( int id) {
+		// Native code drops loads still in flight for this ID
+		Iterator<FastCanvasMessage> pi = mPendingLoads.values().iterator();
+		while (pi.hasNext()) {
+			FastCanvasMessage m = pi.next();
+			if (m.textureID == id) {
+				pi.remove();
+				m.callbackContext.error("Texture unloaded before it finished loading");
+			}
+		}
 		FastCanvasJNI.removeTexture(id);
 		Log.i("CANVAS", "CanvasRenderer unloadtexture");
 		checkError();
@@ -337,9 +441,18 @@ public class FastCanvasRenderer implements GLSurfaceView.Renderer {
 	// ==========================================================================
 	public void reloadTextures() {
 		Log.i("CANVAS", "CanvasRenderer reloadtextures");
+		// PNGs still decoding upload into the new context when they finish
+		HashSet<Integer> pending = new HashSet<Integer>();
+		for (FastCanvasMessage m : mPendingLoads.values()) {
+			pending.add(m.textureID);
+		}
+		
 		Iterator<FastCanvasTexture> ti = mTextures.iterator();
 		while (ti.hasNext()) {
 			FastCanvasTexture t = ti.next();
+			if (pending.contains(t.id)) {
+				continue;
+			}
 			FastCanvasMessage m = new FastCanvasMessage(FastCanvasMessage.Type.RELOAD);
 			m.url = t.url;
 			m.textureID = t.id;
@@ -104,6 +104,10 @@ public class FastCanvasView extends GLSurfaceView {
 	public void execScripts(Object obj) {
 	}
 
+	public FastCanvasRenderer getRenderer() {
+		return mRenderer;
+	}
+
 	private FastCanvasRenderer mRenderer;
 	public boolean isPaused = false;
 }
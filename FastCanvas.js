@@ -234,8 +234,67 @@ FastCanvasUtils._defProp(FastCanvasImage.prototype, "complete",
 function FastContext2D(){
 	this._drawCommands = "";
 	this._globalAlpha = 1.0;
+	// Set when binary rendering is on; takes the place of _drawCommands
+	this._commandBuffer = null;
+	this._binaryRendering = false;
 }
 
+/**
+ * Growable buffer of binary render commands, used instead of the command
+ * string when binary rendering is enabled. Each command is its letter from
+ * the text protocol as one byte, followed by its int32 and then its float32
+ * operands, little endian.
+ * @private
+ */
+function FastCanvasCommandBuffer(){
+	this._buffer = new ArrayBuffer(4096);
+	this._view = new DataView(this._buffer);
+	this._length = 0;
+}
+
+/**
+ * Starts a command, making room for operandBytes bytes of operands.
+ * @private
+ */
+FastCanvasCommandBuffer.prototype.command = function(letter, operandBytes){
+	var needed = this._length + 1 + operandBytes;
+	if (needed > this._buffer.byteLength){
+		var size = this._buffer.byteLength * 2;
+		while (size < needed){
+			size *= 2;
+		}
+		var grown = new ArrayBuffer(size);
+		new Uint8Array(grown).set(new Uint8Array(this._buffer, 0, this._length));
+		this._buffer = grown;
+		this._view = new DataView(grown);
+	}
+	this._view.setUint8(this._length, letter.charCodeAt(0));
+	this._length += 1;
+};
+
+/** @private */
+FastCanvasCommandBuffer.prototype.int32 = function(value){
+	this._view.setInt32(this._length, value, true);
+	this._length += 4;
+};
+
+/** @private */
+FastCanvasCommandBuffer.prototype.float32 = function(value){
+	this._view.setFloat32(this._length, value, true);
+	this._length += 4;
+};
+
+/**
+ * Returns the commands so far in an ArrayBuffer of their own, and empties
+ * the buffer for the next frame.
+ * @private
+ */
+FastCanvasCommandBuffer.prototype.take = function(){
+	var commands = this._buffer.slice(0, this._length);
+	this._length = 0;
+	return commands;
+};
+
 /**
  * Represents the alpha value to be used with drawing commands
  * where 1 is completely visible and 0 is fully transparent.
@@ -244,7 +303,13 @@ function FastContext2D(){
  */
 FastContext2D.prototype.setGlobalAlpha = function(value){
 	this._globalAlpha = value;
-	this._drawCommands = this._drawCommands.concat("a" + value.toFixed(6) + ";" );
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("a", 4);
+		buffer.float32(value);
+	}else{
+		this._drawCommands = this._drawCommands.concat("a" + value.toFixed(6) + ";" );
+	}
 };
 FastContext2D.prototype.getGlobalAlpha = function(){
 		return this._globalAlpha;
@@ -319,7 +384,18 @@ FastContext2D.prototype.unloadTexture = function (image) {
  * @param {number} ty The distance by which to translate the context along the y axis.
  */
 FastContext2D.prototype.setTransform = function(a, b, c, d, tx, ty) {
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("t", 24);
+		buffer.float32(a);
+		buffer.float32(b);
+		buffer.float32(c);
+		buffer.float32(d);
+		buffer.float32(tx);
+		buffer.float32(ty);
+	}else{
 	this._drawCommands = this._drawCommands.concat("t" + (a===1 ? "1" : a.toFixed(6)) + "," + (b===0 ? "0" : b.toFixed(6)) + "," + (c===0 ? "0" : c.toFixed(6)) + "," + (d===1 ? "1" : d.toFixed(6)) + "," + tx + "," + ty + ";");
+	}
 };
 
 /** 
@@ -339,7 +415,18 @@ FastContext2D.prototype.setTransform = function(a, b, c, d, tx, ty) {
  * context along the y axis.
  */
 FastContext2D.prototype.transform = function(a, b, c, d, tx, ty) {
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("f", 24);
+		buffer.float32(a);
+		buffer.float32(b);
+		buffer.float32(c);
+		buffer.float32(d);
+		buffer.float32(tx);
+		buffer.float32(ty);
+	}else{
 	this._drawCommands = this._drawCommands.concat("f" + (a===1 ? "1" : a.toFixed(6)) + "," + (b===0 ? "0" : b.toFixed(6)) + "," + (c===0 ? "0" : c.toFixed(6)) + "," + (d===1 ? "1" : d.toFixed(6)) + "," + tx + "," + ty + ";");
+	}
 };
 
 /** 
@@ -347,7 +434,11 @@ FastContext2D.prototype.transform = function(a, b, c, d, tx, ty) {
  * equivalent to calling <code>context.setTransform(1,0,0,1,0,0)</code>.
  */
 FastContext2D.prototype.resetTransform = function() {
-	this._drawCommands = this._drawCommands.concat("m;");
+	if (this._commandBuffer){
+		this._commandBuffer.command("m", 0);
+	}else{
+		this._drawCommands = this._drawCommands.concat("m;");
+	}
 };
 
 /** 
@@ -358,7 +449,14 @@ FastContext2D.prototype.resetTransform = function() {
  * pixels along the y axis when scaling or rotating the context.
  */
 FastContext2D.prototype.scale = function( a, d ) {
-	this._drawCommands = this._drawCommands.concat("k" + a.toFixed(6) + "," + d.toFixed(6) + ";");
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("k", 8);
+		buffer.float32(a);
+		buffer.float32(d);
+	}else{
+		this._drawCommands = this._drawCommands.concat("k" + a.toFixed(6) + "," + d.toFixed(6) + ";");
+	}
 };
 
 /** 
@@ -366,7 +464,13 @@ FastContext2D.prototype.scale = function( a, d ) {
  * @param {number} angle The value in radians to rotate the context.
  */
 FastContext2D.prototype.rotate = function( angle ) {
-	this._drawCommands = this._drawCommands.concat("r" + angle.toFixed(6) + ";");
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("r", 4);
+		buffer.float32(angle);
+	}else{
+		this._drawCommands = this._drawCommands.concat("r" + angle.toFixed(6) + ";");
+	}
 };
 
 /** 
@@ -377,7 +481,14 @@ FastContext2D.prototype.rotate = function( angle ) {
  * context along the y axis.
  */
 FastContext2D.prototype.translate = function( tx, ty ) {
-	this._drawCommands = this._drawCommands.concat("l" + tx + "," + ty + ";");
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("l", 8);
+		buffer.float32(tx);
+		buffer.float32(ty);
+	}else{
+		this._drawCommands = this._drawCommands.concat("l" + tx + "," + ty + ";");
+	}
 };
 
 /** 
@@ -387,7 +498,11 @@ FastContext2D.prototype.translate = function( tx, ty ) {
  * @see FastContext2D#restore
  */
 FastContext2D.prototype.save = function() {
-	this._drawCommands = this._drawCommands.concat("v;");
+	if (this._commandBuffer){
+		this._commandBuffer.command("v", 0);
+	}else{
+		this._drawCommands = this._drawCommands.concat("v;");
+	}
 };
 
 /** 
@@ -396,7 +511,86 @@ FastContext2D.prototype.save = function() {
  * @see FastContext2D#save
  */
 FastContext2D.prototype.restore = function() {
-	this._drawCommands = this._drawCommands.concat("e;");
+	if (this._commandBuffer){
+		this._commandBuffer.command("e", 0);
+	}else{
+		this._drawCommands = this._drawCommands.concat("e;");
+	}
+};
+
+/** 
+ * Starts recording a display list. Until 
+ * {@link FastContext2D#endDisplayList|endDisplayList()} is called, 
+ * drawImage() calls are stored in the list instead of being drawn. 
+ * The images are recorded with the transform in effect at the time 
+ * and stay on the GPU, so the list can be drawn again in later frames 
+ * with {@link FastContext2D#drawDisplayList|drawDisplayList()} without 
+ * sending its drawImage() calls again. Recording a list with an id 
+ * that is already in use replaces its contents.
+ * <p>Display lists are specific to FastContext2D and are not available
+ * on an HTML 2D context.</p>
+ * @param {number} id An integer identifying the display list.
+ * @example
+ * // record the background once
+ * myContext.beginDisplayList(1);
+ * drawBackgroundTiles(); // performs drawImage calls...
+ * myContext.endDisplayList();
+ *
+ * // then, in every frame
+ * myContext.drawDisplayList(1);
+ */
+FastContext2D.prototype.beginDisplayList = function(id) {
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("b", 4);
+		buffer.int32(id);
+	}else{
+		this._drawCommands = this._drawCommands.concat("b" + id + ";");
+	}
+};
+
+/** 
+ * Ends the recording started with 
+ * {@link FastContext2D#beginDisplayList|beginDisplayList()}.
+ */
+FastContext2D.prototype.endDisplayList = function() {
+	if (this._commandBuffer){
+		this._commandBuffer.command("n", 0);
+	}else{
+		this._drawCommands = this._drawCommands.concat("n;");
+	}
+};
+
+/** 
+ * Draws a recorded display list under the current 2D matrix transform
+ * and globalAlpha. Display lists cannot be drawn while another one is 
+ * being recorded.
+ * @param {number} id The id given to 
+ * {@link FastContext2D#beginDisplayList|beginDisplayList()}.
+ */
+FastContext2D.prototype.drawDisplayList = function(id) {
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("c", 4);
+		buffer.int32(id);
+	}else{
+		this._drawCommands = this._drawCommands.concat("c" + id + ";");
+	}
+};
+
+/** 
+ * Deletes a recorded display list and frees its GPU memory.
+ * @param {number} id The id given to 
+ * {@link FastContext2D#beginDisplayList|beginDisplayList()}.
+ */
+FastContext2D.prototype.deleteDisplayList = function(id) {
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("x", 4);
+		buffer.int32(id);
+	}else{
+		this._drawCommands = this._drawCommands.concat("x" + id + ";");
+	}
 };
 
 /** 
@@ -441,7 +635,31 @@ FastContext2D.prototype.drawImage = function(
 	dx, dy, dw, dh) {	// destination
 	
 	var numArgs = arguments.length;
-	if (numArgs <= 3){
+	var buffer = this._commandBuffer;
+	if (buffer){
+		buffer.command("d", 36);
+		buffer.int32(image._id);
+		if (numArgs <= 5){
+			// source is the whole image, s becomes d
+			buffer.float32(0);
+			buffer.float32(0);
+			buffer.float32(image.width);
+			buffer.float32(image.height);
+			buffer.float32(sx);
+			buffer.float32(sy);
+			buffer.float32(numArgs <= 3 ? image.width : sw);
+			buffer.float32(numArgs <= 3 ? image.height : sh);
+		}else{
+			buffer.float32(sx);
+			buffer.float32(sy);
+			buffer.float32(sw);
+			buffer.float32(sh);
+			buffer.float32(dx);
+			buffer.float32(dy);
+			buffer.float32(dw);
+			buffer.float32(dh);
+		}
+	}else if (numArgs <= 3){
 		// drawImage(image, dx,dy); position only (s becomes d)
 		this._drawCommands = this._drawCommands.concat("d" + image._id + ",0,0," + image.width + "," + image.height + "," + sx + "," + sy + "," + image.width + "," + image.height + ";");
 			
@@ -479,16 +697,26 @@ FastContext2D.prototype.drawImage = function(
  * FastCanvas.render(); // calls FastContext2D.render()
  */
 FastContext2D.prototype.render = function () {
-	var commands = this._drawCommands;
-	this._drawCommands = "";
-	FastCanvasUtils._toNative(null, null, 'FastCanvas', 'render', [commands]);
+	if (this._commandBuffer){
+		FastCanvasUtils._toNative(null, null, 'FastCanvas', 'renderBinary', [this._commandBuffer.take()]);
+	}else{
+		var commands = this._drawCommands;
+		this._drawCommands = "";
+		FastCanvasUtils._toNative(null, null, 'FastCanvas', 'render', [commands]);
+	}
+	// switching between text and binary commands happens between frames
+	if (this._binaryRendering){
+		this._commandBuffer = this._commandBuffer || new FastCanvasCommandBuffer();
+	}else{
+		this._commandBuffer = null;
+	}
 };
 
 /**
  * Implementation of FastCanvas.capture.
  * @private
  */
-FastContext2D.prototype.capture = function(x,y,w,h,fileName, successCallback, errorCallback) {
+FastContext2D.prototype.capture = function(x,y,w,h,fileName, successCallback, errorCallback, options) {
 	if (successCallback && typeof successCallback !== 'function') {
 		throw new Error('successCallback parameter not a function');
 	}
@@ -496,7 +724,23 @@ FastContext2D.prototype.capture = function(x,y,w,h,fileName, successCallback, er
 		throw new Error('errorCallback parameter not a function');
 	}
 	
-	FastCanvasUtils._toNative(successCallback, errorCallback, 'FastCanvas', 'capture', [x,y,w,h,fileName]);
+	var compression = (options && options.compression) || "default";
+	var output = (options && options.output) || "file";
+	var thumbWidth = (options && options.thumbnailWidth) || 0;
+	var thumbHeight = (options && options.thumbnailHeight) || 0;
+	var success = successCallback;
+	if (successCallback && output === "rgba") {
+		// The native side puts the width and height, little endian, before the pixels
+		success = function(buffer) {
+			var dims = new DataView(buffer, 0, 8);
+			successCallback({
+				width: dims.getUint32(0, true),
+				height: dims.getUint32(4, true),
+				data: new Uint8Array(buffer, 8)
+			});
+		};
+	}
+	FastCanvasUtils._toNative(success, errorCallback, 'FastCanvas', 'capture', [x,y,w,h,fileName,compression,output,thumbWidth,thumbHeight]);
 };
 
 /**
@@ -842,6 +1086,80 @@ FastCanvas.setBackgroundColor = function (color) {
 	}
 };
 
+/**
+ * Turns texture atlasing on or off for images loaded afterwards.
+ * When on, small PNG images (up to 256x256) are packed together into
+ * shared textures, so drawImage calls alternating between them can be
+ * drawn in a single batch. Atlased images report their actual size
+ * rather than a size padded to a power of two. Source rectangles must
+ * stay within the image, since the pixels around it belong to other
+ * images.
+ * @param {boolean} enabled True to pack images loaded from now on.
+ * @example
+ * FastCanvas.setTextureAtlasEnabled(true);
+ * myIcon.src = "images/icon.png"; // shares a texture with other icons
+ */
+FastCanvas.setTextureAtlasEnabled = function (enabled) {
+	if (FastCanvas.isFast){
+		FastCanvasUtils._toNative(null, null, 'FastCanvas', 'setTextureAtlas', [!!enabled]);
+	}
+};
+
+/**
+ * Turns culling of off-screen draws on or off. When on, drawImage calls
+ * that fall entirely outside the canvas are dropped natively instead of
+ * being sent to the GPU. Draws recorded into a display list are never
+ * culled, since where they end up depends on the transform when the
+ * list is drawn.
+ * @param {boolean} enabled True to drop draws outside the canvas.
+ * @example
+ * FastCanvas.setViewportCullingEnabled(true);
+ */
+FastCanvas.setViewportCullingEnabled = function (enabled) {
+	if (FastCanvas.isFast){
+		FastCanvasUtils._toNative(null, null, 'FastCanvas', 'setViewportCulling', [!!enabled]);
+	}
+};
+
+/**
+ * Turns binary rendering on or off. When on, drawing commands are packed
+ * into an ArrayBuffer instead of a string, which skips formatting the
+ * numbers as text in JavaScript and parsing them again natively. The
+ * change takes effect from the next frame, after the next render call.
+ * Needs typed arrays with DataView support.
+ * @param {boolean} enabled True to send frames in binary.
+ * @return {boolean} True if binary rendering is now on.
+ * @example
+ * FastCanvas.setBinaryRenderingEnabled(true);
+ */
+FastCanvas.setBinaryRenderingEnabled = function (enabled) {
+	if (FastCanvas._instance === null){
+		throw new Error("A new canvas must be created with FastCanvas.create() before FastCanvas.setBinaryRenderingEnabled() can be used");
+	}
+	if (!FastCanvas.isFast){
+		return false;
+	}
+	var binary = !!enabled && typeof ArrayBuffer === 'function' && typeof DataView === 'function';
+	FastCanvas._instance.getContext()._binaryRendering = binary;
+	return binary;
+};
+
+/**
+ * Turns reordering of draws into batches on or off. When on, a
+ * drawImage call can be drawn together with an earlier one using the
+ * same image (or atlas page), as long as it doesn't overlap anything
+ * drawn in between, so the result looks the same with fewer draw calls.
+ * Draws are never moved across a display list.
+ * @param {boolean} enabled True to let draws be reordered.
+ * @example
+ * FastCanvas.setBatchReorderingEnabled(true);
+ */
+FastCanvas.setBatchReorderingEnabled = function (enabled) {
+	if (FastCanvas.isFast){
+		FastCanvasUtils._toNative(null, null, 'FastCanvas', 'setBatchReordering', [!!enabled]);
+	}
+};
+
 /**
  * Determines the background color to use for the FastCanvas
  * depending on the background color style the fastCanvas instance
@@ -929,10 +1247,21 @@ FastCanvas._getBackgroundColor = function(){
  * storage location.
  * @param {function} successCallback Callback for when the capture completed successfully.
  * @param {function} errorCallback Callback for when the capture did not complete successfully.
+ * @param {Object} [options] Optional settings. options.compression is how hard to
+ * compress the PNG: "store" (fastest, largest files), "fast", "default" or "best"
+ * (slowest, smallest files). "fast" is several times quicker than "default" for
+ * files slightly larger. options.output keeps the capture in memory instead of
+ * writing fileName, which is then ignored: "png" passes the PNG file's bytes to
+ * successCallback as an ArrayBuffer, and "rgba" skips PNG encoding and passes
+ * {width, height, data}, data being a Uint8Array of RGBA pixels, top row first.
+ * The default, "file", writes the file. options.thumbnailWidth and
+ * options.thumbnailHeight shrink the capture to that size, averaging the pixels,
+ * before it is encoded; with only one of them given the other keeps the aspect
+ * ratio. Captures are never enlarged.
  */
-FastCanvas.capture = function(x,y,w,h,fileName, successCallback, errorCallback) {
+FastCanvas.capture = function(x,y,w,h,fileName, successCallback, errorCallback, options) {
 	if (FastCanvas.isFast){
-		FastCanvas._instance.getContext().capture(x,y,w,h,fileName, successCallback, errorCallback);
+		FastCanvas._instance.getContext().capture(x,y,w,h,fileName, successCallback, errorCallback, options);
 	}
 }
 